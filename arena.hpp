@@ -0,0 +1,192 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <iostream>
+#include <sys/mman.h>
+
+/*
+ * Fixed size block allocator for tree nodes.
+ *
+ * Blocks are carved from big chunks (2M by default), their size is
+ * rounded up to the cache line so every node starts on a cache line.
+ * Not to a power of two of the node size: that nearly doubles the
+ * memory of a tree, and a node spans as many lines either way.
+ * Freed blocks go to a free list and are reused first.
+ * Chunks are unmapped all at once by the destructor, so a whole tree
+ * is released in O(chunks) without walking it.
+ * A chunk may be on 2M pages (huge), transparent ones (madvise) or
+ * hugetlbfs ones (MAP_HUGETLB, reserved by vm.nr_hugepages; when there
+ * are none left, transparent ones instead): a TLB entry maps 512 4K
+ * pages of nodes.
+ *
+ * Memory is type stable: a freed block stays mapped till release(),
+ * only its first word is overwritten by the free list, so a reader
+ * racing with free never faults (see the concurrent btree).
+ * set_shared(true) makes alloc and free thread safe, with a spin lock.
+ */
+
+#define ARENA_LINE	64UL
+#define ARENA_CHUNK	(2UL << 20) // 2M, one huge page.
+
+// pages of the chunks.
+#define ARENA_4K	0
+#define ARENA_THP	1 // transparent huge pages, madvise(MADV_HUGEPAGE).
+#define ARENA_HUGETLB	2 // MAP_HUGETLB, else ARENA_THP.
+
+class node_arena {
+public:
+	const size_t block_size;
+	const size_t chunk_size;
+	int huge;        // ARENA_*, pages of the chunks.
+
+	// stat.
+	size_t block_count;  // blocks in use.
+	size_t chunk_count;
+
+	node_arena(size_t size, int huge_ = ARENA_4K, size_t chunk = ARENA_CHUNK)
+		: block_size((size + ARENA_LINE - 1) & ~(ARENA_LINE - 1)),
+		// whole huge pages.
+		chunk_size(((chunk < block_size ? block_size : chunk) +
+					ARENA_CHUNK - 1) & ~(ARENA_CHUNK - 1)),
+		huge(huge_),
+		block_count(0),
+		chunk_count(0),
+		shared(false),
+		lock_word(0),
+		free_list(NULL),
+		cur(NULL),
+		end(NULL)
+	{
+	}
+
+	~node_arena()
+	{
+		release();
+	}
+
+	void set_shared(bool s)
+	{
+		shared = s;
+	}
+
+	// zero filled block, or as it was freed if !zero, but the first
+	// word (fresh blocks are zero anyway).
+	void *alloc(bool zero = true)
+	{
+		void *p;
+		lock();
+		if (free_list) {
+			p = free_list;
+			free_list = free_list->next;
+			if (zero)
+				memset(p, 0, block_size);
+		}
+		else {
+			if (cur + block_size > end && !grow()) {
+				unlock();
+				return NULL;
+			}
+			p = cur; // fresh chunk memory is zero.
+			cur += block_size;
+		}
+		block_count++;
+		unlock();
+		return p;
+	}
+
+	void free(void *p)
+	{
+		free_block *b = (free_block *)p;
+		lock();
+		b->next = free_list;
+		free_list = b;
+		block_count--;
+		unlock();
+	}
+
+	// unmap all chunks, every block is gone.
+	void release()
+	{
+		for (size_t i = 0; i < chunks.size(); i++)
+			munmap(chunks[i], chunk_size);
+		chunks.clear();
+		free_list = NULL;
+		cur = end = NULL;
+		block_count = 0;
+		chunk_count = 0;
+	}
+
+	size_t mapped_bytes()
+	{
+		return chunks.size() * chunk_size;
+	}
+
+private:
+	struct free_block {
+		free_block *next;
+	};
+
+	bool shared;
+	char lock_word;
+	free_block *free_list;
+	char *cur, *end; // bump region of the last chunk.
+	std::vector<char *> chunks;
+
+	void lock()
+	{
+		if (!shared)
+			return;
+		while (__atomic_test_and_set(&lock_word, __ATOMIC_ACQUIRE))
+			__builtin_ia32_pause();
+	}
+
+	void unlock()
+	{
+		if (shared)
+			__atomic_clear(&lock_word, __ATOMIC_RELEASE);
+	}
+
+	// map a new chunk, aligned to chunk size for huge pages.
+	bool grow()
+	{
+		if (huge == ARENA_HUGETLB) {
+			char *h = (char *)mmap(NULL, chunk_size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (h != MAP_FAILED) {
+				chunks.push_back(h);
+				chunk_count++;
+				cur = h;
+				end = h + chunk_size;
+				return true;
+			}
+			std::cerr << "node_arena: no hugetlb pages, transparent"
+				" huge pages instead." << std::endl;
+			huge = ARENA_THP;
+		}
+		size_t len = chunk_size + ARENA_CHUNK;
+		char *p = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			std::cerr << "node_arena: mmap failed." << std::endl;
+			return false;
+		}
+		// trim head and tail to the aligned chunk.
+		char *a = (char *)(((size_t)p + ARENA_CHUNK - 1) & ~(ARENA_CHUNK - 1));
+		if (a > p)
+			munmap(p, a - p);
+		if (p + len > a + chunk_size)
+			munmap(a + chunk_size, (p + len) - (a + chunk_size));
+		if (huge)
+			madvise(a, chunk_size, MADV_HUGEPAGE);
+		chunks.push_back(a);
+		chunk_count++;
+		cur = a;
+		end = a + chunk_size;
+		return true;
+	}
+};
+
+#endif
@@ -4,11 +4,117 @@
 #include <map>
 #include <algorithm>
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "timer.hpp"
 
 using namespace std;
 
+// wall clock in seconds, Timer counts the cpu time of all threads.
+inline double wall_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// resident set size of this process, in K-bytes.
+inline long rss_kb()
+{
+	long pages = 0, rss = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld", &pages, &rss) != 2)
+		rss = 0;
+	fclose(f);
+	return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// K-bytes of this process on huge pages, transparent, file ones
+// mapped by a PMD, or hugetlbfs.
+inline long huge_kb()
+{
+	long kb = 0, n;
+	char line[128];
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if ((sscanf(line, "AnonHugePages: %ld", &n) == 1) ||
+				(sscanf(line, "FilePmdMapped: %ld", &n) == 1) ||
+				(sscanf(line, "Private_Hugetlb: %ld", &n) == 1) ||
+				(sscanf(line, "Shared_Hugetlb: %ld", &n) == 1))
+			kb += n;
+	fclose(f);
+	return kb;
+}
+
+// dTLB load misses.
+#define PERF_DTLB_READ_MISS (PERF_COUNT_HW_CACHE_DTLB | \
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+// a hardware event of this thread in user space, perf_event_open(2).
+// ok() is false where it cannot be counted: no PMU (most VMs),
+// perf_event_paranoid.
+class perf_counter
+{
+	int fd;
+
+public:
+	perf_counter(uint32_t type = PERF_TYPE_HW_CACHE,
+			uint64_t config = PERF_DTLB_READ_MISS)
+	{
+		struct perf_event_attr a;
+		memset(&a, 0, sizeof(a));
+		a.size = sizeof(a);
+		a.type = type;
+		a.config = config;
+		a.disabled = 1;
+		a.exclude_kernel = 1;
+		a.exclude_hv = 1;
+		fd = syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+	}
+
+	~perf_counter()
+	{
+		if (fd != -1)
+			close(fd);
+	}
+
+	bool ok() const
+	{
+		return fd != -1;
+	}
+
+	void start()
+	{
+		if (fd == -1)
+			return;
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	// events since start().
+	uint64_t stop()
+	{
+		uint64_t n = 0;
+		if (fd == -1)
+			return 0;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &n, sizeof(n)) != sizeof(n))
+			n = 0;
+		return n;
+	}
+};
+
 class benchmark
 {
 	const int cnt;
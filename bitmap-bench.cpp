@@ -0,0 +1,87 @@
+/* *
+ * Free inode bitmap microbenchmark: allocate all 1M inodes of an index,
+ * free some at random and allocate them again, with the scan from word
+ * 0 disk_map::allocate_inode() did before and with inode_bitmap.
+ */
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "bench.hpp"
+#include "bitmap.hpp"
+
+using namespace std;
+
+#define N_INODES (1024 * 1024)
+#define N_WORDS  (N_INODES / 32)
+
+// the former allocator: first free bit from word 0, bit by bit.
+static long scan_alloc(uint32_t *bitmap)
+{
+	for (uint32_t i = 0; i < N_WORDS; i++) {
+		if (bitmap[i] == 0xFFFFFFFFUL)
+			continue;
+		for (uint32_t j = 0; j < 32; j++) {
+			if (bitmap[i] & (1U << j))
+				continue;
+			bitmap[i] |= (1U << j);
+			return i * 32 + j;
+		}
+	}
+	return -1;
+}
+
+static void scan_free(uint32_t *bitmap, uint32_t idx)
+{
+	bitmap[idx / 32] &= ~(1U << (idx % 32));
+}
+
+int
+main(int argc, char *argv[])
+{
+	Timer timer;
+	// inodes freed and allocated again.
+	long n_free = argc > 1 ? atol(argv[1]) : N_INODES / 10;
+	uint32_t *map = new uint32_t[N_WORDS];
+	uint32_t *idx = new uint32_t[N_INODES];
+
+	for (int pass = 0; pass < 2; pass++) {
+		const char *name = pass ? "inode_bitmap" : "scan";
+		memset(map, 0, N_WORDS * sizeof(uint32_t));
+		map[0] = 0x1; // inode 0 is reserved.
+		inode_bitmap bm(map, N_WORDS);
+
+		cout << "### " << name << ": allocate all inodes" << endl;
+		long n = 0, i;
+		timer.Start();
+		while ((i = pass ? bm.alloc() : scan_alloc(map)) >= 0)
+			idx[n++] = i;
+		double t_fill = timer.Stop();
+		cout << "inodes: " << n << endl;
+		cout << "time for every allocation(sec): " << t_fill / n << endl;
+
+		srand(1);
+		random_shuffle(idx, idx + n);
+		for (long j = 0; j < n_free; j++) {
+			if (pass)
+				bm.free(idx[j]);
+			else
+				scan_free(map, idx[j]);
+		}
+		cout << "### " << name << ": allocate " << n_free
+			<< " freed inodes again" << endl;
+		long m = 0;
+		timer.Start();
+		while (m < n_free && (pass ? bm.alloc() : scan_alloc(map)) >= 0)
+			m++;
+		double t_refill = timer.Stop();
+		cout << "inodes: " << m << endl;
+		cout << "time for every allocation(sec): "
+			<< (m ? t_refill / m : 0) << endl;
+	}
+
+	delete [] idx;
+	delete [] map;
+	return 0;
+}
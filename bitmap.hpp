@@ -0,0 +1,200 @@
+#ifndef __BITMAP_H__
+#define __BITMAP_H__
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+/*
+ * Two level free inode bitmap.
+ *
+ * Leaf: the bitmap of the index header, 1 bit per inode, set if used.
+ * Summary: 1 bit per leaf word, set if the word is full. It lives in
+ * memory only and is rebuilt from the leaf at open.
+ * The words in use cover the pages of the index file, they are
+ * extended as it grows; bits past them are free.
+ *
+ * Allocation is next fit: it goes on from the word of the last one,
+ * full words are skipped 64 at a time thru the summary and the free
+ * bit of a word is found by ctz on the inverted word, so filling the
+ * bitmap is O(1) amortized instead of a scan from word 0 every time.
+ *
+ * Placement: with a hint (the inode of a sibling) the free inode
+ * nearest after it in the next PLACE_NEAR words is taken, so a node
+ * split off lands next to its sibling when the index has holes; with
+ * none near, next fit as above.
+ */
+
+// words searched from the hint's one, 8 x 32 inodes x 4K: 1M.
+#define PLACE_NEAR 8
+
+class inode_bitmap {
+public:
+	inode_bitmap(uint32_t *map_, uint32_t n_words_)
+		: map(map_), n_words(n_words_), cursor(0),
+		summary((n_words_ + 63) / 64, 0)
+	{
+		rebuild();
+	}
+
+	// summary of the leaf words.
+	void rebuild()
+	{
+		for (uint32_t s = 0; s < summary.size(); s++)
+			summary[s] = 0;
+		for (uint32_t w = 0; w < n_words; w++)
+			if (map[w] == 0xFFFFFFFFU)
+				summary[w / 64] |= 1ULL << (w % 64);
+	}
+
+	// use the leaf words up to n_words_.
+	void extend(uint32_t n_words_)
+	{
+		if (n_words_ <= n_words)
+			return;
+		summary.resize((n_words_ + 63) / 64, 0);
+		for (uint32_t w = n_words; w < n_words_; w++)
+			if (map[w] == 0xFFFFFFFFU)
+				summary[w / 64] |= 1ULL << (w % 64);
+		n_words = n_words_;
+	}
+
+	uint32_t words()
+	{
+		return n_words;
+	}
+
+	// mark a free bit used and return it, -1 if full.
+	long alloc()
+	{
+		long w = find_word(cursor);
+		if (w < 0)
+			return -1;
+		cursor = w;
+		return take(w, ~map[w]);
+	}
+
+	// a free inode near hint, else alloc(). hint 0: none.
+	long alloc(uint64_t hint)
+	{
+		if (hint == 0 || hint / 32 >= n_words)
+			return alloc();
+		uint32_t w = hint / 32;
+		// bits from the hint on, then the next words.
+		uint32_t f = ~map[w] & ~((1U << (hint % 32)) - 1);
+		if (f)
+			return take(w, f);
+		long n = find_word(w + 1 < n_words ? w + 1 : 0);
+		if (n > (long)w && n - w <= PLACE_NEAR)
+			return take(n, ~map[n]);
+		return alloc();
+	}
+
+	void free(uint64_t idx)
+	{
+		uint32_t w = idx / 32;
+		map[w] &= ~(1U << (idx % 32));
+		summary[w / 64] &= ~(1ULL << (w % 64));
+	}
+
+	bool test(uint64_t idx)
+	{
+		return map[idx / 32] & (1U << (idx % 32));
+	}
+
+private:
+	uint32_t *map;      // leaf, the mapped header bitmap.
+	uint32_t n_words;
+	uint32_t cursor;    // word of the last allocation.
+	std::vector<uint64_t> summary;
+
+	// mark the lowest of the free bits f of word w used.
+	long take(uint32_t w, uint32_t f)
+	{
+		uint32_t j = __builtin_ctz(f);
+		map[w] |= 1U << j;
+		if (map[w] == 0xFFFFFFFFU)
+			summary[w / 64] |= 1ULL << (w % 64);
+		return (long)w * 32 + j;
+	}
+
+	// first word not full from word w on, wrapping around, -1 if none.
+	long find_word(uint32_t w)
+	{
+		if (n_words == 0)
+			return -1;
+		uint32_t n_sum = summary.size();
+		uint32_t s = w / 64;
+		// words w.. of the first summary word.
+		uint64_t full = summary[s] | ((1ULL << (w % 64)) - 1);
+		for (uint32_t i = 0; i <= n_sum; i++) {
+			if (~full) {
+				uint32_t f = s * 64 + __builtin_ctzll(~full);
+				if (f < n_words)
+					return f;
+			}
+			s = s + 1 < n_sum ? s + 1 : 0;
+			full = summary[s];
+		}
+		return -1;
+	}
+};
+
+/*
+ * Set of pages changed since the last flush, 1 bit per page to list
+ * each once: listing and clearing it is O(pages changed), not of the
+ * file, and runs() coalesces adjacent pages for ranged writes.
+ */
+class dirty_set {
+public:
+	typedef std::pair<uint64_t, uint64_t> run; // first page, pages.
+
+	void add(uint64_t i)
+	{
+		uint64_t w = i / 64, m = 1ULL << (i % 64);
+		if (w >= bits.size())
+			bits.resize(w + 1 + w / 2, 0);
+		if (bits[w] & m)
+			return;
+		bits[w] |= m;
+		list.push_back(i);
+	}
+
+	size_t size()
+	{
+		return list.size();
+	}
+
+	bool test(uint64_t i)
+	{
+		return i / 64 < bits.size() && (bits[i / 64] & (1ULL << (i % 64)));
+	}
+
+	// the pages as runs of adjacent ones, ascending.
+	std::vector<run> runs()
+	{
+		std::sort(list.begin(), list.end());
+		std::vector<run> r;
+		for (size_t i = 0; i < list.size(); i++) {
+			if (!r.empty() && r.back().first + r.back().second == list[i])
+				r.back().second++;
+			else
+				r.push_back(run(list[i], 1));
+		}
+		return r;
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < list.size(); i++)
+			bits[list[i] / 64] = 0;
+		list.clear();
+	}
+
+private:
+	std::vector<uint64_t> bits;
+	std::vector<uint64_t> list; // pages set, in the order added.
+};
+
+#endif
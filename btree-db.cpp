@@ -4,19 +4,32 @@
 #include <iostream>
 #include <iomanip>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
 #include <ctime>
 #include <cassert>
+#include <vector>
+#include <unistd.h> // getopt
+#include <sys/resource.h> // getrusage
+#include <sys/stat.h>
+#include <sys/mman.h> // madvise
+#include <climits>
+#include <string>
+#include <thread>
+#include <mutex>
 
 #include "bench.hpp"
 #include "disk.hpp"
+#include "search.hpp"
 
 using namespace std;
 
 #define DEBUG 1
 #define PROFILE
 
-template <class K, class V>
+// P: page size of the index, a node per page.
+// PTR: child pointer, u32 in a v1 index, u40 in a v2 one.
+template <class K, class V, u32 P = SZ_4K, class PTR = u40>
 struct btree {
 	// Key-Value pair.
 	struct key_val {
@@ -32,8 +45,7 @@ struct btree {
 	 * +----+---+----+----+----+------+---+-+
 	 */
 	struct item { // node entry.
-        //TODO: limit ptr size to 32-bit, even in a 64-bit env.
-        u32 i; // ptr(node index) to child node.
+        PTR i; // ptr(node index) to child node.
 		union /*ANON*/ {
 			key_val kv;
 			struct /*ANON*/ {
@@ -42,18 +54,27 @@ struct btree {
 			} /*ANON*/;
 		} /*ANON*/;
 		item() :i(0xDEADBEEFul) {}
-	} __attribute__((packed, aligned(4))); // align to 4-byte.
+	} __attribute__((packed)); // 20 bytes, 21 with a u40 ptr.
+
+#define MAX_NODE_SIZE P
+	// items:  [t-1, 2*t-1]
+	// height: <= log(t,(n+1)/2)
+	// a compile-time constant: node header and 2t items (one more for
+	// the last ptr) fill the payload of a node page.
+	enum {
+		t = (MAX_NODE_SIZE - sizeof(disk_map::inode) - 2 * sizeof(int))
+			/ sizeof(item) / 2
+	};
 
-#define MAX_NODE_SIZE SZ_4K
 	struct node {
-		bool leaf;     // is leaf node?
-		int n;         // keys in node.
-		item items[1]; // one more as last node ptr.
+		bool leaf;       // is leaf node?
+		int n;           // keys in node.
+		item items[2*t]; // one more as last node ptr.
 		node() :n(0) {}
 	};
 
 #define NODE_ITEM(x, i)	((x)->items[i])
-#define NODE_PTR(x, i)	((x)->items[i].i)
+#define NODE_PTR(x, n)	((x)->items[n].i) // not i, the member name.
 #define NODE_KEY(x, i)	((x)->items[i].k)
 #define NODE_VAL(x, i)	((x)->items[i].v)
 #define NODE_KVP(x, i)	((x)->items[i].kv)
@@ -65,29 +86,56 @@ struct btree {
 #define NODE_FIRST_KVP(x)  ((x)->items[0].kv)
 #define NODE_LAST_KVP(x)   ((x)->items[(x)->n-1].kv)
 
+// keys of node x, sizeof(item) apart, right after the first ptr.
+// (not &NODE_KEY(x, 0): items are packed, keys may be unaligned.)
+#define NODE_KEYS(x) ((const char *)(x)->items + sizeof(PTR))
+
+// index of the first key >= k (LOWER) or > k (UPPER) in node x.
+#define NODE_LOWER_BOUND(x, k) \
+	key_lower_bound<K>(NODE_KEYS(x), sizeof(item), (x)->n, k)
+#define NODE_UPPER_BOUND(x, k) \
+	key_upper_bound<K>(NODE_KEYS(x), sizeof(item), (x)->n, k)
+
 #define MIN_ITEMS (t - 1)
 #define MAX_ITEMS (2*t - 1)
+#define MAX_LEVELS 32 // height limit.
 
 // get ptr/index of node
 #define NODE2IDX(x) (disk->payload2index(x))
 
-	// items:  [t-1, 2*t-1]
-	// height: <= log(t,(n+1)/2)
-	int t;
+// split policy of a full node.
+#define SPLIT_EVEN      0 // 50/50 split, always.
+#define SPLIT_APPEND    1 // biased split on every append to the right spine.
+#define SPLIT_AUTO      2 // biased split once a run of appends is detected.
+
+// ascending inserts in a row before SPLIT_AUTO goes biased.
+#define APPEND_RUN      16
+
 	node *root, *root_bak;
 	int node_count;
 
     // disk map.
     struct disk_map *disk;
-    int max_items_count; // calculated by page size and item size.
 
 	// b-tree-create(T)
 	// require O(1) disk operations and O(1) CPU time.
-	btree() :
+	btree(int policy = SPLIT_AUTO, double ratio = 1.0) :
         root(NULL),
-		last_error(0),
 		node_count(0),
+		place_hint(true),
+		last_error(0),
+		split_policy(policy),
+		split_ratio(ratio),
+		append_run(0),
+		last_insert_key(0),
+		split_biased_cnt(0),
 		split_cnt(0),
+		right_depth(0),
+		right_has_max(false),
+		append_fast(true),
+		append_fast_cnt(0),
+		multi_willneed(false),
+		descent_willneed(false),
 		erase_cnt(0),
 		search_miss_cnt(0),
 		fixup_cnt(0),
@@ -99,18 +147,24 @@ struct btree {
 		rebalance_inter_cnt(0)
         {
             // disk file map.
-            disk = new disk_map();
-            uint n_item = (MAX_NODE_SIZE - sizeof(node)) / sizeof(item);
+            disk = new disk_map(P, sizeof(PTR) == sizeof(u32) ? 1 : 2);
+            assert(sizeof(disk_map::inode) + sizeof(node) <= MAX_NODE_SIZE);
             cout << "key_val size: " << std::dec << sizeof(key_val) << endl;
             cout << "item size: " << std::dec << sizeof(item) << endl;
-            cout << "max items in node: " << std::dec << n_item << endl;
-            max_items_count = n_item;
-            t = max_items_count / 2;
+            cout << "node size: " << std::dec << sizeof(node) << endl;
             cout << "       t = " << t << endl;
             cout << "max items: " << MAX_ITEMS << endl;
             cout << "min items: " << MIN_ITEMS << endl;
 
             init_root_node();
+            if (disk->shadow)
+                shadow_reclaim();
+        }
+
+    // pages of a buffer pool written back.
+    ~btree()
+        {
+            delete disk;
         }
 
     void init_root_node()
@@ -121,18 +175,25 @@ struct btree {
             cout << "init_root_node(): root:" << root << endl;
             // new tree.
             if (root == NULL) {
+                disk->begin_op(true);
                 root = allocate_node();
+                if (root == NULL) { // read only.
+                    cerr << "init_root_node(): no root node." << endl;
+                    throw -2;
+                }
                 root->leaf = true;
                 root->n = 0;
-                disk->hdr->root_node_index = disk->payload2index(root);
+                disk_write(root);
+                disk->hdr->set_root(disk->payload2index(root));
+                disk->end_op();
                 cerr << "NEW root node: " << root
                     << ", leaf:" << root->leaf
                     << ", n:" << root->n
-                    << ", idx:" << disk->hdr->root_node_index << endl;
+                    << ", idx:" << disk->hdr->root() << endl;
             }
             // check root node.
             assert(root != NULL);
-            u32 idx = disk->hdr->root_node_index;
+            u64 idx = disk->hdr->root();
             if (idx == 0) {
                 cerr << "init_root_node(): " << idx << endl;
                 throw -2;
@@ -142,12 +203,56 @@ struct btree {
                 << "backup root node addr: " << root_bak << endl;
             //XXX chekc if root == root_backup.
         }
+
+    // shadow paging: a crash after the bitmap of a commit got to disk
+    // but before its root leaves the nodes of that batch allocated, out
+    // of the tree. when the bitmap counts more nodes than the header,
+    // the tree is walked and those nodes are freed by the next commit;
+    // the leaves are not read. return the nodes freed.
+    u64 shadow_reclaim()
+    {
+        u64 pages = disk->map_len_file / P, used = 0;
+        for (u64 idx = 1; idx < pages; idx++)
+            used += disk->bitmap->test(idx);
+        if (used <= disk->hdr->nodes())
+            return 0;
+        std::vector<bool> in(pages, false);
+        std::vector<u64> level(1, disk->hdr->root()), next;
+        disk->begin_op(true);
+        while (!level.empty()) {
+            node *x = disk_read(level[0]);
+            bool leaf = x == NULL || x->leaf;
+            if (x)
+                disk->unpin(x);
+            next.clear();
+            for (size_t i = 0; i < level.size(); i++) {
+                in[level[i]] = true;
+                if (leaf || (x = disk_read(level[i])) == NULL)
+                    continue;
+                for (int j = 0; j <= x->n; j++)
+                    next.push_back(NODE_PTR(x, j));
+                disk->unpin(x);
+            }
+            level.swap(next);
+        }
+        u64 freed = 0;
+        for (u64 idx = 1; idx < pages; idx++)
+            if (disk->bitmap->test(idx) && !in[idx]) {
+                disk->shadow_reclaim(idx);
+                freed++;
+            }
+        disk->end_op();
+        cout << "shadow: " << freed << " nodes of a lost commit freed."
+             << endl;
+        return freed;
+    }
     
 	// height of tree.
 	// include root node.
 	int height()
         {
-            return 1 + height(root);
+            disk->begin_op(false);
+            return root->leaf ? 1 : 1 + height(root);
         }
 
 	// height of subtree from node x.
@@ -162,10 +267,14 @@ struct btree {
 
 	size_t node_size;
 
-	node *allocate_node()
+    // place a new node near the inode of a sibling, so the nodes of a
+    // subtree are near in idx.bin and faulted in by one readahead.
+    bool place_hint;
+
+	node *allocate_node(node *near = NULL)
         {
             node_count++;
-            return (node *)disk->allocate();
+            return (node *)disk->allocate(place_hint && near ? NODE2IDX(near) : 0);
         }
 
 	void free_node(node *x)
@@ -187,10 +296,15 @@ struct btree {
 	// mmap ?
 	// disk to main memory.
 	// x: addr in disk
-	node *disk_read(u32 idx)
+	// with a buffer pool, the node stays pinned till the next
+	// operation; inner nodes are retained longer than leaves.
+	node *disk_read(u64 idx)
         {
             // relative addr x to real addr y.
-            return (node *)disk->read(idx);
+            node *x = (node *)disk->read(idx);
+            if (x && !x->leaf)
+                disk->retain(x);
+            return x;
         }
     
     // set y as child node of x at ptr i.
@@ -208,24 +322,105 @@ struct btree {
 
     node *get_child_node(node *x, int i)
         {
-            u32 ptr = NODE_PTR(x, i);
+            u64 ptr = NODE_PTR(x, i);
             return disk->read(ptr);
         }
 
     node *get_last_child_node(node *x)
         {
-            u32 ptr = NODE_LAST_PTR(x);
+            u64 ptr = NODE_LAST_PTR(x);
             return (node *)disk->read(ptr);
         }
 
 #define BTREE_NO_ERROR          0
 #define BTREE_OUT_OF_STORAGE    0x1
+#define BTREE_READ_FAILED       0x2
     int last_error;
 
+    // shadow paging: a node of the last committed tree is changed in
+    // a copy of it, the parent pointing to the copy; the parent is
+    // made writable first, so a write goes down thru cow_root() and
+    // cow_child().
+    // a copy may fail for want of a free node: NULL, and the operation
+    // stops there, before it changes a node, so the tree stays as the
+    // copies made so far left it, the committed one never written.
+
+    // x, a node of the committed tree, copied to a new node.
+    // return NULL if no node is left.
+    node *cow_copy(node *x)
+        {
+            node *y = allocate_node(x);
+            if (y == NULL) {
+                cerr << __func__ << "(): allocate node failed." << endl;
+                last_error = BTREE_OUT_OF_STORAGE;
+                return NULL;
+            }
+            memcpy(y, x, sizeof(node));
+            disk_write(y);
+            free_node(x); // at the next commit.
+            return y;
+        }
+
+    // the root, writable.
+    node *cow_root()
+        {
+            if (disk->is_fresh(root))
+                return root;
+            node *y = cow_copy(root);
+            if (y == NULL)
+                return NULL;
+            root = y;
+            disk->hdr->set_root(NODE2IDX(root));
+            return root;
+        }
+
+    // child i of writable node x, writable.
+    node *cow_child(node *x, int i)
+        {
+            node *y = disk_read(NODE_PTR(x, i));
+            if (disk->is_fresh(y))
+                return y;
+            y = cow_copy(y);
+            if (y == NULL)
+                return NULL;
+            set_child_node(x, i, y);
+            disk_write(x);
+            return y;
+        }
+
+    int split_policy;
+    double split_ratio;  // items left in y by a biased split, of MAX_ITEMS.
+    u32 append_run;      // current run of ascending inserts.
+    K last_insert_key;
+    int split_biased_cnt;
+
+    // items left in full node y, child i of x, when splitting it for key k.
+    // a key beyond every key of the last child of a node on the right
+    // spine (right) is an append: keep y (nearly) full and move little,
+    // or nothing, to the new right node, the keys to come go right
+    // anyway. the last child of any other node has keys to its right.
+    int split_point(node *x, const int i, node *y, K k, bool right)
+    {
+        if (split_policy == SPLIT_EVEN || !right || i != x->n ||
+                k <= NODE_KEY(y, y->n - 1))
+            return MIN_ITEMS;
+        if (split_policy == SPLIT_AUTO && append_run < APPEND_RUN)
+            return MIN_ITEMS;
+        int m = (int)(split_ratio * MAX_ITEMS);
+        if (m < MIN_ITEMS)
+            m = MIN_ITEMS;
+        if (m > MAX_ITEMS - 1)
+            m = MAX_ITEMS - 1; // the median goes up: empty right node.
+        if (m != MIN_ITEMS)
+            split_biased_cnt++;
+        return m;
+    }
+
 	int split_cnt;
 	// ITEM(i) >> ITEM(i+1)
     // return new node z
-	node *split_child(node *x, const int i, node *y)
+    // m: items left in y, y.key[m] goes up, the rest goes to z.
+	node *split_child(node *x, const int i, node *y, int m)
 	{
 		// split on full node y.
         //assert(x->ptr[i] == y);
@@ -234,23 +429,23 @@ struct btree {
 
 		split_cnt++;
 
-		node *z = allocate_node();
+		node *z = allocate_node(y);
         if (z == NULL) {
             cerr << __func__ << "(): allocate node failed." << endl;
             last_error = BTREE_OUT_OF_STORAGE;
             return NULL;
         }
 		z->leaf = y->leaf;
-		z->n = MIN_ITEMS;
-		// move right half (t-1 nodes) to z.
+		z->n = MAX_ITEMS - m - 1;
+		// move right part (2t-2-m items) to z.
 		// k, v and child ptr.
-		// [0,t-2],[t-1],[t,2t-2],{2t-1}
-		// t-1,1,t-1
-        // [0,t-1] <= [t,2t-1] 
-		for (int j = 0; j < t; j++) // include the last ptr.
-			NODE_ITEM(z, j) = NODE_ITEM(y, t + j);
+		// [0,m-1],[m],[m+1,2t-2],{2t-1}
+		// m,1,2t-2-m
+        // [0,z->n] <= [m+1,2t-1]
+		for (int j = 0; j <= z->n; j++) // include the last ptr.
+			NODE_ITEM(z, j) = NODE_ITEM(y, m + 1 + j);
 		// shrink node y.
-		y->n = MIN_ITEMS;
+		y->n = m;
 		// make room for median item(from last item of y) of y and z.
 		for (int j = x->n+1; j > i; j--) // include last ptr of x.
 			NODE_ITEM(x, j) = NODE_ITEM(x, j-1);
@@ -258,7 +453,7 @@ struct btree {
 		// [n,i+1],[i,n+1]
 		// move y.key[t-1] up.
         // set kv of node i.
-		NODE_KVP(x, i) = NODE_KVP(y, t-1);
+		NODE_KVP(x, i) = NODE_KVP(y, m);
         // set ptr of node i, i+1.
         set_child_node(x, i,   y);
         set_child_node(x, i+1, z);
@@ -270,17 +465,113 @@ struct btree {
         return z;
 	}
 
-#define ROOT_NODE_INDEX (disk->hdr->root_node_index)
+#define ROOT_NODE_INDEX (disk->hdr->root())
+
+    // rightmost path, root first, as node indexes.
+    // valid while right_depth > 0, dropped by any insert or erase
+    // which does not go thru insert_append().
+    u64 right_path[MAX_LEVELS];
+    int right_depth;
+    bool right_has_max; // false on empty tree or unknown max.
+    K right_max;        // max key of the tree.
+    bool append_fast;   // use insert_append().
+    int append_fast_cnt;
+
+    // cache the rightmost path below right_path[l].
+    // the max key is the last key of the deepest non-empty node,
+    // right nodes may be empty after a biased split.
+    void right_path_fill(int l)
+    {
+        node *x = disk_read(right_path[l]);
+        for (;;) {
+            if (x->n > 0) {
+                right_max = NODE_LAST_KVP(x).k;
+                right_has_max = true;
+            }
+            if (x->leaf)
+                break;
+            right_path[++l] = NODE_LAST_PTR(x);
+            x = disk_read(right_path[l]);
+        }
+        right_depth = l + 1;
+    }
+
+    // insert kv beyond the max key without a descent from the root:
+    // start at the lowest non-full node of the rightmost path, so only
+    // the full nodes below it are split.
+    // return false if kv is not an append or the root is full.
+    bool insert_append(key_val kv)
+    {
+        if (right_has_max && kv.k <= right_max)
+            return false;
+        if (right_depth == 0) {
+            right_path[0] = ROOT_NODE_INDEX;
+            right_has_max = false;
+            right_path_fill(0);
+            if (right_has_max && kv.k <= right_max)
+                return false;
+        }
+        int l = right_depth - 1;
+        node *x = disk_read(right_path[l]);
+        while (x->n >= MAX_ITEMS) {
+            if (l == 0)
+                return false; // new root, leave it to insert().
+            x = disk_read(right_path[--l]);
+        }
+        if (disk->shadow) { // the path down to x, writable.
+            x = cow_root();
+            for (int j = 0; x && j <= l; j++) {
+                right_path[j] = NODE2IDX(x);
+                if (j < l)
+                    x = cow_child(x, x->n);
+            }
+            if (x == NULL) { // ends here, last_error set.
+                right_depth = 0;
+                return true;
+            }
+        }
+        insert_nonfull(x, kv, true);
+        if (l < right_depth - 1) // nodes below x split.
+            right_path_fill(l);
+        right_max = kv.k;
+        right_has_max = true;
+        append_fast_cnt++;
+        return true;
+    }
 
-	// insert new key into leaf node
+	// insert new key into leaf node, an operation of the log.
 	void insert(key_val kv)
 	{
+        disk->begin_op(true);
+        insert_kv(kv);
+        disk->end_op();
+	}
+
+	void insert_kv(key_val kv)
+	{
+        if (kv.k > last_insert_key)
+            append_run++;
+        else
+            append_run = 0;
+        last_insert_key = kv.k;
+
+        if (append_fast && insert_append(kv))
+            return;
+        // may split nodes of the rightmost path.
+        right_depth = 0;
+        if (!right_has_max || kv.k > right_max) {
+            right_max = kv.k;
+            right_has_max = true;
+        }
+
+        if (cow_root() == NULL)
+            return;
         // insert into full root node;
         // produce a new root node.
 		if (root->n >= MAX_ITEMS) {
 			cout << endl << "Insert into full root node #" << root << endl;
             cout << endl << "Node count: " << node_count << endl;
-			node *new_root = allocate_node();
+			node *new_root = allocate_node(root);
             if (new_root == NULL) {
                 cerr << __func__ << "(): allocate node failed." << endl;
                 last_error = BTREE_OUT_OF_STORAGE;
@@ -290,34 +581,40 @@ struct btree {
 			new_root->n    = 0;
             // root is left child of new root.
             set_child_node(new_root, 0, root); //NODE_FIRST_PTR(s) = root;
-			split_child(new_root, 0, root); // split on node r.
+			if (split_child(new_root, 0, root,
+                    split_point(new_root, 0, root, kv.k, true)) == NULL) {
+                free_node(new_root);
+                return;
+            }
 			root = new_root;
             // update new root
-            ROOT_NODE_INDEX = NODE2IDX(new_root);
+            disk->hdr->set_root(NODE2IDX(new_root));
 		}
-        insert_nonfull(root, kv);
+        insert_nonfull(root, kv, true);
 	}
 
     //TODO handle duplicate key.
-	void insert_nonfull(node *x, key_val kv)
+    // right: x is on the right spine, the root or the last child of a
+    // node on it.
+	void insert_nonfull(node *x, key_val kv, bool right)
 	{
         assert(x->n < MAX_ITEMS);
 //cerr << "+" << __func__ << "(): x:" << x << endl;
 		//XXX x->nΪ0.
-		int i = x->n - 1;
+		int i = NODE_UPPER_BOUND(x, kv.k);
 //cerr << "x:       " << x << endl
 //     << "x->n:    " << x->n << endl
 //     << "x->leaf: " << (u32)x->leaf << endl;
         // simple case: insert into non-full, leaf node.
 		if (x->leaf) {
 			//node *lc = get_last_child_node(x);
-			//[1,...,n] <= [0,...,n - 1]
+			//[i+1,...,n] <= [i,...,n - 1]
 			//XXX preserve the last ptr of x.
-            u32 last_ptr = NODE_LAST_PTR(x);
-			for (; i >= 0 && kv.k < NODE_KEY(x, i); i--)
-				NODE_ITEM(x, i+1) = NODE_ITEM(x, i);
+            PTR last_ptr = NODE_LAST_PTR(x);
+			for (int j = x->n; j > i; j--)
+				NODE_ITEM(x, j) = NODE_ITEM(x, j-1);
 			// insert key-val-pair kv into x.
-			NODE_KVP(x, i+1) = kv;
+			NODE_KVP(x, i) = kv;
 			x->n++;
 			//XXX restore the last ptr of x.
             NODE_LAST_PTR(x) = last_ptr;
@@ -325,23 +622,672 @@ struct btree {
             return;
 		}
 
-        // search thru the non-leaf node.
-        for (; i >= 0 && kv.k < NODE_KEY(x, i); i--)
-            ;
-        //FIX: -1 => 0; i' => i'+1; n-1 => n
-        i++;
-        node *y = disk_read(NODE_PTR(x, i));
+        // search thru the non-leaf node: i in [0, n].
+        if (descent_willneed)
+            disk->prefetch(NODE_PTR(x, i));
+        node *y = cow_child(x, i);
+        if (y == NULL)
+            return;
 
         // split full node y down the road.
         if (y->n >= MAX_ITEMS) {
-            node *z = split_child(x, i, y);
-            if (kv.k > NODE_KEY(x, i))
+            node *z = split_child(x, i, y,
+                    split_point(x, i, y, kv.k, right));
+            if (z == NULL)
+                return;
+            if (kv.k > NODE_KEY(x, i)) {
                 y = z; // search right half
+                i++;
+            }
         }
         // now we can insert into non-full node y.
-        insert_nonfull(y, kv);
+        insert_nonfull(y, kv, right && i == x->n);
+	}
+
+	// build the tree bottom up from sorted, unique items [first, last).
+	// nodes are filled left to right up to fill_factor of MAX_ITEMS,
+	// the item after a filled node goes up to the next level as the
+	// separator of it and the next node. no split, every node is
+	// written once, but the right spine: it may be left underfull,
+	// and bulk_fix_right() fills and writes its nodes again.
+	// the tree must be empty, and is left empty if a node can not be
+	// allocated (last_error).
+	template <class iterator>
+	void bulk_load(iterator first, iterator last, double fill_factor = 1.0)
+	{
+		assert(root->leaf && root->n == 0);
+		disk->begin_op(true);
+		if (cow_root() == NULL) {
+			disk->end_op();
+			return;
+		}
+		int fill = (int)(fill_factor * MAX_ITEMS);
+		if (fill < MIN_ITEMS)
+			fill = MIN_ITEMS;
+		if (fill > MAX_ITEMS)
+			fill = MAX_ITEMS;
+
+		node *open[MAX_LEVELS]; // the last node of each level.
+		int levels = 1;
+		open[0] = root;
+		for (; first != last && !last_error; ++first)
+			bulk_push(open, levels, *first, fill);
+		if (last_error) {
+			bulk_undo(open[levels - 1]);
+			disk->end_op();
+			return;
+		}
+		for (int l = 0; l < levels; l++)
+			disk_write(open[l]);
+		root = open[levels - 1];
+		disk->hdr->set_root(NODE2IDX(root));
+
+		while (bulk_fix_right())
+			;
+		right_depth = 0;
+		right_has_max = false;
+		// written to the index as a whole, not thru the log.
+		disk->checkpoint();
+		disk->end_op();
+	}
+
+	// append kv to the last leaf. a full node is closed, and kv goes
+	// up between it and a new node, till a level not full, or a new
+	// root. the new nodes are allocated first: if one fails, nothing
+	// is changed and kv is not loaded (last_error).
+	void bulk_push(node **open, int &levels, const key_val &kv, int fill)
+	{
+		int full = 0;
+		while (full < levels && open[full]->n >= fill)
+			full++;
+		node *fresh[MAX_LEVELS]; // fresh[full]: the new root.
+		int need = full < levels ? full : full + 1;
+		assert(need <= MAX_LEVELS);
+		for (int l = 0; l < need; l++) {
+			fresh[l] = allocate_node(open[l < levels ? l : levels - 1]);
+			if (fresh[l] == NULL) {
+				while (l--)
+					free_node(fresh[l]);
+				cerr << __func__ << "(): allocate node failed." << endl;
+				last_error = BTREE_OUT_OF_STORAGE;
+				return;
+			}
+		}
+		if (full == levels) { // the old root is the left child.
+			node *r = fresh[full];
+			r->leaf = false;
+			r->n = 0;
+			set_child_node(r, 0, open[levels - 1]);
+			open[levels++] = r;
+		}
+		node *c = NULL; // right child of kv.
+		for (int l = 0; l < full; l++) {
+			node *x = open[l];
+			disk_write(x);
+			disk->unpin(x); // closed, the pool may write it back.
+			node *y = fresh[l];
+			y->leaf = x->leaf;
+			y->n = 0;
+			NODE_FIRST_PTR(y) = c ? NODE2IDX(c) : 0;
+			open[l] = y;
+			c = y;
+		}
+		node *x = open[full];
+		NODE_KVP(x, x->n) = kv;
+		NODE_PTR(x, x->n+1) = c ? NODE2IDX(c) : 0;
+		x->n++;
+	}
+
+	// free the nodes of a failed bulk_load() under top, but the root,
+	// which is emptied again.
+	void bulk_undo(node *top)
+	{
+		u64 r = NODE2IDX(root);
+		bulk_free(top, r);
+		root = disk_read(r);
+		root->leaf = true;
+		root->n = 0;
+		disk_write(root);
+	}
+
+	void bulk_free(node *x, u64 keep)
+	{
+		if (!x->leaf)
+			for (int i = 0; i <= x->n; i++)
+				bulk_free(disk_read(NODE_PTR(x, i)), keep);
+		if (NODE2IDX(x) != keep)
+			free_node(x);
+		disk->unpin(x);
 	}
 
+	// fix the underfull last child on the right spine, top down.
+	// return true if a concate took a key from a node of the spine,
+	// which may underflow it, so run again.
+	bool bulk_fix_right()
+	{
+		bool again = false;
+		node *x = cow_root();
+		while (x && !x->leaf) {
+			node *y = disk_read(NODE_LAST_PTR(x));
+			if (y->n < MIN_ITEMS) {
+				int n = x->n;
+				if (!fixup(x, x->n))
+					return false;
+				if (x->n < n)
+					again = true;
+				// strip empty root node.
+				if (x == root && x->n == 0) {
+					root = disk_read(NODE_FIRST_PTR(x));
+					disk->hdr->set_root(NODE2IDX(root));
+					free_node(x);
+					x = cow_root();
+					continue;
+				}
+			}
+			x = cow_child(x, x->n);
+		}
+		return again;
+	}
+
+    // in-order walk of the items, the input of a bulk_load() of
+    // another tree: the path from the root to the item, the leftmost
+    // leaf of the next subtree read as the walk gets there. mmap
+    // backend only, a node is not pinned.
+    struct scan_iterator {
+        btree *t;
+        node *path[MAX_LEVELS];
+        int pos[MAX_LEVELS]; // item of each node on the path.
+        int depth;           // of the item, -1: the end.
+
+        scan_iterator(btree *t_ = NULL) : t(t_), depth(-1)
+        {
+            if (t) {
+                t->disk->begin_op(false);
+                down(t->root);
+            }
+        }
+
+        // the leftmost leaf below x, then up to the first item left.
+        void down(node *x)
+        {
+            for (; x; x = t->disk_read(NODE_FIRST_PTR(x))) {
+                path[++depth] = x;
+                pos[depth] = 0;
+                if (x->leaf)
+                    break;
+            }
+            while (depth >= 0 && pos[depth] >= path[depth]->n)
+                depth--;
+        }
+
+        key_val operator*() const // a copy, items are packed.
+        {
+            return NODE_KVP(path[depth], pos[depth]);
+        }
+
+        // after key i of an inner node, its child i+1.
+        scan_iterator &operator++()
+        {
+            node *x = path[depth];
+            int i = ++pos[depth];
+            if (!x->leaf)
+                down(t->disk_read(NODE_PTR(x, i)));
+            else
+                while (depth >= 0 && pos[depth] >= path[depth]->n)
+                    depth--;
+            return *this;
+        }
+
+        // the end only.
+        bool operator!=(const scan_iterator &o) const
+        {
+            return depth != o.depth;
+        }
+    };
+
+    scan_iterator scan_begin() { return scan_iterator(this); }
+    scan_iterator scan_end()   { return scan_iterator(); }
+
+    // in-order walk of an index of 8-byte node headers, from before
+    // node checksums, its pages pread from idx.bin fd: the input of the
+    // bulk_load() converting it. a node page of the path per level, the
+    // node at INODE_HEADER_SIZE_V0, maybe with a few items more than
+    // node::items, within its page; a page not read ends the walk and
+    // counts in *bad.
+    struct v0_iterator {
+        int fd;
+        u64 *bad;
+        std::vector<char> pages; // MAX_LEVELS pages.
+        int pos[MAX_LEVELS];
+        int depth;
+
+        v0_iterator(int fd_ = -1, u64 root = 0, u64 *bad_ = NULL)
+            : fd(fd_), bad(bad_), depth(-1)
+        {
+            if (fd != -1) {
+                pages.resize((size_t)MAX_LEVELS * P);
+                down(root);
+            }
+        }
+
+        node *path(int d) const
+        {
+            return (node *)(&pages[(size_t)d * P] + INODE_HEADER_SIZE_V0);
+        }
+
+        void down(u64 idx)
+        {
+            for (;;) {
+                if (++depth == MAX_LEVELS || idx == 0 ||
+                        pread(fd, &pages[(size_t)depth * P], P,
+                            idx * P) != (ssize_t)P) {
+                    (*bad)++;
+                    depth = -1;
+                    return;
+                }
+                node *x = path(depth);
+                pos[depth] = 0;
+                if (x->leaf)
+                    break;
+                idx = NODE_FIRST_PTR(x);
+            }
+            while (depth >= 0 && pos[depth] >= path(depth)->n)
+                depth--;
+        }
+
+        key_val operator*() const
+        {
+            return NODE_KVP(path(depth), pos[depth]);
+        }
+
+        v0_iterator &operator++()
+        {
+            node *x = path(depth);
+            int i = ++pos[depth];
+            if (!x->leaf)
+                down(NODE_PTR(x, i));
+            else
+                while (depth >= 0 && pos[depth] >= path(depth)->n)
+                    depth--;
+            return *this;
+        }
+
+        bool operator!=(const v0_iterator &o) const
+        {
+            return depth != o.depth;
+        }
+    };
+
+// node order of copy_from().
+#define LAYOUT_BFS 1 // level by level from the root.
+#define LAYOUT_VEB 2 // van Emde Boas: the top half of the levels, then
+                     // each subtree below it, recursively.
+
+    // the nodes of the h levels from node r, in order of layout.
+    void layout_order(int layout, u64 r, int h, std::vector<u64> &out)
+    {
+        if (layout == LAYOUT_BFS || h == 1) {
+            for (int l = 0; l < h; l++)
+                nodes_below(r, l, out);
+            return;
+        }
+        int top = h / 2;
+        layout_order(layout, r, top, out);
+        std::vector<u64> below;
+        nodes_below(r, top, below);
+        for (size_t i = 0; i < below.size(); i++)
+            layout_order(layout, below[i], h - top, out);
+    }
+
+    // the nodes d levels below node r, left to right, appended to out.
+    // the nodes above are read, not the ones appended.
+    void nodes_below(u64 r, int d, std::vector<u64> &out)
+    {
+        if (d == 0) {
+            out.push_back(r);
+            return;
+        }
+        node *x = disk_read(r);
+        if (x == NULL || x->leaf)
+            return;
+        for (int j = 0; j <= x->n; j++)
+            nodes_below(NODE_PTR(x, j), d - 1, out);
+    }
+
+    // copy every node of src into this tree, empty and just created,
+    // in order of layout, to consecutive nodes of the new index, the
+    // child pointers mapped. mmap backend only.
+    // return the nodes copied, 0 on error.
+    u64 copy_from(btree &src, int layout)
+    {
+        assert(root->leaf && root->n == 0);
+        std::vector<u64> seq;
+        int h = src.height();
+        src.layout_order(layout, src.disk->hdr->root(), h, seq);
+        // node index in src: in this tree, the root reused.
+        std::vector<u64> to(src.disk->map_len_file / P + 1, 0);
+        disk->begin_op(true);
+        to[seq[0]] = NODE2IDX(root);
+        for (size_t i = 1; i < seq.size(); i++) {
+            node *y = allocate_node();
+            if (y == NULL) {
+                cerr << __func__ << "(): allocate node failed." << endl;
+                last_error = BTREE_OUT_OF_STORAGE;
+                disk->end_op();
+                return 0;
+            }
+            to[seq[i]] = NODE2IDX(y);
+        }
+        for (size_t i = 0; i < seq.size(); i++) {
+            node *x = src.disk_read(seq[i]);
+            node *y = disk_read(to[seq[i]]);
+            if (x == NULL || y == NULL) {
+                disk->end_op();
+                return 0;
+            }
+            memcpy(y, x, sizeof(node));
+            if (!y->leaf)
+                for (int j = 0; j <= y->n; j++)
+                    NODE_PTR(y, j) = to[NODE_PTR(x, j)];
+            disk_write(y);
+        }
+        disk->hdr->file_count = src.disk->hdr->file_count;
+        disk->hdr->total_file_size = src.disk->hdr->total_file_size;
+        right_depth = 0;
+        right_has_max = false;
+        // written to the index as a whole, as a bulk load.
+        disk->checkpoint();
+        disk->end_op();
+        return seq.size();
+    }
+
+    // consistency check(fsck) of the index, the subtrees below the top
+    // levels walked by threads, straight from the mapping: mmap backend
+    // only, nothing in the disk_map changed.
+
+// errors printed, the rest counted.
+#define FSCK_PRINT 10
+
+    // per level.
+    struct fsck_level {
+        u64 nodes, items;
+        int min_n, max_n;
+    };
+
+    // of a walk, merged at the end.
+    struct fsck_stat {
+        u64 errors;
+        u64 underfull;       // fewer than MIN_ITEMS, off the right spine.
+        u64 spine_underfull; // on it, left by biased splits, bulk loads.
+        std::vector<fsck_level> levels;
+
+        fsck_stat(int h) : errors(0), underfull(0), spine_underfull(0),
+            levels(h)
+        {
+            for (int l = 0; l < h; l++) {
+                levels[l].nodes = levels[l].items = 0;
+                levels[l].min_n = INT_MAX;
+                levels[l].max_n = 0;
+            }
+        }
+
+        void merge(const fsck_stat &o)
+        {
+            errors += o.errors;
+            underfull += o.underfull;
+            spine_underfull += o.spine_underfull;
+            for (size_t l = 0; l < levels.size(); l++) {
+                levels[l].nodes += o.levels[l].nodes;
+                levels[l].items += o.levels[l].items;
+                levels[l].min_n = std::min(levels[l].min_n, o.levels[l].min_n);
+                levels[l].max_n = std::max(levels[l].max_n, o.levels[l].max_n);
+            }
+        }
+    };
+
+    // a subtree to check: its root at level, the keys of the subtree
+    // strictly between lo and hi(if has_lo, has_hi).
+    struct fsck_task {
+        u64 idx;
+        int level;
+        bool has_lo, has_hi;
+        K lo, hi;
+        bool spine; // on the right spine(the root too).
+    };
+
+    // shared by the threads of a check.
+    struct fsck_ctx {
+        int height;
+        u64 pages;              // of idx.bin.
+        std::vector<u64> seen;  // nodes reached, 1 bit each.
+        std::mutex out;         // of the errors printed.
+        u32 printed;
+    };
+
+    void fsck_error(fsck_ctx &c, fsck_stat &st, u64 idx, const char *what)
+    {
+        st.errors++;
+        std::lock_guard<std::mutex> g(c.out);
+        if (c.printed++ < FSCK_PRINT)
+            cerr << "fsck: node " << std::dec << idx << ": " << what << endl;
+    }
+
+    // check node tk.idx itself, NULL if it is not to be walked down.
+    node *fsck_node(fsck_ctx &c, const fsck_task &tk, fsck_stat &st)
+    {
+        u64 idx = tk.idx;
+        if (idx == 0 || idx >= c.pages) {
+            fsck_error(c, st, idx, "child pointer out of idx.bin");
+            return NULL;
+        }
+        u64 bit = 1ULL << (idx % 64);
+        if (__atomic_fetch_or(&c.seen[idx / 64], bit, __ATOMIC_RELAXED) & bit) {
+            fsck_error(c, st, idx, "reached twice");
+            return NULL;
+        }
+        if (!disk->bitmap->test(idx))
+            fsck_error(c, st, idx, "in the tree, free in the bitmap");
+        disk_map::inode *ino = (disk_map::inode *)((char *)disk->ino_base
+                + idx * P);
+        if (ino->length != P || ino->index != (u32)idx) {
+            fsck_error(c, st, idx, "bad node header");
+            return NULL;
+        }
+        if (ino->crc != disk->inode_sum(ino))
+            fsck_error(c, st, idx, "checksum mismatch");
+        node *x = (node *)ino->payload;
+        int n = x->n;
+        if (n < 0 || n > MAX_ITEMS) {
+            fsck_error(c, st, idx, "item count out of bounds");
+            return NULL;
+        }
+        if ((bool)x->leaf != (tk.level == c.height - 1)) {
+            fsck_error(c, st, idx, "leaf at another level");
+            return NULL;
+        }
+        if (x->n < MIN_ITEMS && tk.level > 0) {
+            if (tk.spine)
+                st.spine_underfull++;
+            else
+                st.underfull++;
+        }
+        for (int i = 0; i < x->n; i++) {
+            K k = NODE_KEY(x, i);
+            if ((i > 0 && !(NODE_KEY(x, i - 1) < k)) ||
+                    (i == 0 && tk.has_lo && !(tk.lo < k)) ||
+                    (i == x->n - 1 && tk.has_hi && !(k < tk.hi))) {
+                fsck_error(c, st, idx, "keys out of order");
+                break;
+            }
+        }
+        fsck_level &lv = st.levels[tk.level];
+        lv.nodes++;
+        lv.items += x->n;
+        lv.min_n = std::min(lv.min_n, x->n);
+        lv.max_n = std::max(lv.max_n, x->n);
+        return x->leaf ? NULL : x;
+    }
+
+    // the children of inner node x of task tk, appended to out.
+    void fsck_children(const fsck_task &tk, node *x,
+            std::vector<fsck_task> &out)
+    {
+        for (int j = 0; j <= x->n; j++) {
+            fsck_task ch = tk;
+            ch.idx = NODE_PTR(x, j);
+            ch.level = tk.level + 1;
+            if (j > 0) {
+                ch.has_lo = true;
+                ch.lo = NODE_KEY(x, j - 1);
+            }
+            if (j < x->n) {
+                ch.has_hi = true;
+                ch.hi = NODE_KEY(x, j);
+            }
+            ch.spine = tk.spine && j == x->n;
+            out.push_back(ch);
+        }
+    }
+
+    void fsck_subtree(fsck_ctx &c, const fsck_task &tk, fsck_stat &st)
+    {
+        node *x = fsck_node(c, tk, st);
+        if (x == NULL)
+            return;
+        std::vector<fsck_task> ch;
+        fsck_children(tk, x, ch);
+        for (size_t j = 0; j < ch.size(); j++)
+            fsck_subtree(c, ch[j], st);
+    }
+
+    // check the tree: the levels from the root checked here till one
+    // has 4 subtrees a thread, the subtrees below by threads threads.
+    // then the bitmap: a node allocated but not in the tree is leaked
+    // (the nodes of a shadow batch or of an operation not logged, lost
+    // by a crash), a warning; one in the tree but free is an error.
+    // willneed: the whole idx.bin madvise(WILLNEED)d first.
+    // print a report per level, return the errors.
+    u64 fsck(int threads, bool willneed)
+    {
+        fsck_ctx c;
+        c.height = height();
+        c.pages = disk->map_len_file / P;
+        // the pages of idx.bin on the way, in file order, while the
+        // walk goes on.
+        if (willneed)
+            madvise(disk->ino_base, disk->map_len_file, MADV_WILLNEED);
+        c.seen.assign(c.pages / 64 + 1, 0);
+        c.printed = 0;
+        fsck_stat st(c.height);
+
+        fsck_task tk = {ROOT_NODE_INDEX, 0, false, false, K(), K(), true};
+        std::vector<fsck_task> level(1, tk), next;
+        while (!level.empty() && level.size() < 4 * (size_t)threads) {
+            next.clear();
+            for (size_t i = 0; i < level.size(); i++) {
+                node *x = fsck_node(c, level[i], st);
+                if (x)
+                    fsck_children(level[i], x, next);
+            }
+            level.swap(next);
+        }
+
+        std::vector<fsck_stat> sts(threads, fsck_stat(c.height));
+        std::vector<std::thread> th;
+        size_t task = 0;
+        for (int id = 0; id < threads; id++)
+            th.push_back(std::thread([this, &c, &level, &sts, &task, id]() {
+                for (;;) {
+                    size_t i = __atomic_fetch_add(&task, 1, __ATOMIC_RELAXED);
+                    if (i >= level.size())
+                        break;
+                    fsck_subtree(c, level[i], sts[id]);
+                }
+            }));
+        for (int id = 0; id < threads; id++) {
+            th[id].join();
+            st.merge(sts[id]);
+        }
+
+        u64 reached = 0, allocated = 0, leaked = 0;
+        for (u64 idx = 1; idx < c.pages; idx++) {
+            bool in = c.seen[idx / 64] & (1ULL << (idx % 64));
+            bool used = disk->bitmap->test(idx);
+            reached += in;
+            allocated += used;
+            leaked += used && !in;
+        }
+        u64 items = 0;
+        cout << "fsck: height " << c.height << ", subtrees " << level.size()
+             << ", threads " << threads << endl;
+        for (int l = 0; l < c.height; l++) {
+            fsck_level &lv = st.levels[l];
+            items += lv.items;
+            cout << "level " << l << ": nodes " << lv.nodes << ", items "
+                 << lv.items << ", fill " << std::fixed << std::setprecision(3)
+                 << (lv.nodes ? (double)lv.items / lv.nodes / MAX_ITEMS : 0)
+                 << std::defaultfloat << ", n " << (lv.nodes ? lv.min_n : 0)
+                 << " .. " << lv.max_n << endl;
+        }
+        cout << "fsck: items " << items << ", nodes reached " << reached
+             << ", allocated " << allocated << ", header " << disk->hdr->nodes()
+             << ", leaked " << leaked << endl;
+        cout << "fsck: underfull " << st.underfull << ", on the right spine "
+             << st.spine_underfull << ", errors " << st.errors << endl;
+        return st.errors;
+    }
+
+    // load the nodes of the top depth levels(0: every level above the
+    // leaves) and lock them in memory, so only a leaf access may miss.
+    // willneed: the pages of a level are madvise(WILLNEED)d at once,
+    // read in parallel, before it is walked.
+    // with a buffer pool, POOL_MIN_FRAMES frames are left unlocked for
+    // the other pages: the warmup stops short of them.
+    // return the nodes locked.
+    u64 warmup(int depth, bool willneed)
+    {
+        std::vector<u64> level(1, ROOT_NODE_INDEX), next;
+        u64 locked = 0, budget = (u64)-1;
+        if (disk->pool) {
+            u64 f = disk->pool->frame_count();
+            budget = f > POOL_MIN_FRAMES ? f - POOL_MIN_FRAMES : 0;
+        }
+        disk->begin_op(false);
+        for (int l = 0; !level.empty() && (depth == 0 || l < depth); l++) {
+            // the leaf level is not loaded, nor prefetched.
+            node *x = disk_read(level[0]);
+            bool leaf = x && x->leaf;
+            if (x)
+                disk->unpin(x);
+            if (leaf && depth == 0)
+                return locked;
+            if (willneed)
+                for (size_t i = 0; i < level.size(); i++)
+                    disk->prefetch(level[i]);
+            next.clear();
+            for (size_t i = 0; i < level.size(); i++) {
+                if (locked >= budget) {
+                    cerr << "warmup: cut short at level " << l << ", "
+                         << locked << " nodes locked, the pool of "
+                         << disk->pool->frame_count() << " frames keeps "
+                         << POOL_MIN_FRAMES << " unlocked." << endl;
+                    return locked;
+                }
+                x = disk_read(level[i]);
+                if (x == NULL)
+                    continue;
+                if (disk->lock(x))
+                    locked++;
+                if (!x->leaf)
+                    for (int j = 0; j <= x->n; j++)
+                        next.push_back(NODE_PTR(x, j));
+                disk->unpin(x);
+            }
+            level.swap(next);
+        }
+        return locked;
+    }
+
     // kvp count
     u64 item_count(node *x)
     {
@@ -350,24 +1296,29 @@ struct btree {
             return cnt;
 
         for (int i = 0; i <= x->n; ++i) {
-            u32 ptr = NODE_PTR(x, i);
+            u64 ptr = NODE_PTR(x, i);
             node *y = disk_read(ptr);
+            if (y == NULL) // unreadable, a checksum mismatch.
+                continue;
             cnt += item_count(y);
+            disk->unpin(y);
         }
         return cnt;
     }
 
     u64 item_count()
     {
+        disk->begin_op(false);
         return item_count(root);
     }
 
     node *get_max_node()
     {
         cerr << __func__ << "(): node count:"
-            << disk->hdr->node_count << endl;
-        if (disk->hdr->node_count == 0)
+            << disk->hdr->nodes() << endl;
+        if (disk->hdr->nodes() == 0)
             return NULL;
+        disk->begin_op(false);
         return search_max(root);
     }
 
@@ -379,6 +1330,7 @@ struct btree {
         }
         cerr << __func__ << "(): root:" << root
              << "(): root->n:" << root->n << endl;
+        disk->begin_op(false);
         node *x = search_max(root);
         if (!x) {
             cerr << __func__ << "(): no max node." << endl;
@@ -396,6 +1348,7 @@ struct btree {
         }
         cerr << __func__ << "(): root:" << root
              << "(): root->n:" << root->n << endl;
+        disk->begin_op(false);
         node *x = search_min(root);
         if (!x) {
             cerr << __func__ << "(): no max node." << endl;
@@ -415,7 +1368,7 @@ struct btree {
 		node *lc = disk_read(NODE_LAST_PTR(x));
         if (lc == x) {
             cerr << "search_max(): invalid node: " << x << endl;
-            last_error = 2;
+            last_error = BTREE_READ_FAILED;
             return NULL;
         }
 		return search_max(lc);
@@ -424,11 +1377,11 @@ struct btree {
 	// find the min item in node x or its subtree.
 	node *search_min(node *x)
 	{
+		if (!x || !x->n)
+			return NULL;
         cerr << __func__ << "(): x:" << x
              << ", leaf:" << x->leaf
              << ", n:" << x->n << endl;
-		if (!x || !x->n)
-			return NULL;
 		if (x->leaf)
 			return x;
 		node *s = disk_read(NODE_FIRST_PTR(x));
@@ -472,8 +1425,10 @@ struct btree {
 		cout << setfill('<') << setw(40) << ":" << endl;
 	}
 
+	// the value is valid till the next operation.
 	V *search(K k)
 	{
+		disk->begin_op(false);
 		return search(root, k);
 	}
 
@@ -481,10 +1436,10 @@ struct btree {
 	// search item with key k in node x and its subtree.
 	V *search(node *x, K k)
 	{
-		int i = 0;
+		if (x == NULL) // unreadable node.
+			return NULL;
 		// search
-		while (i < x->n && k > NODE_KEY(x, i))
-			i++;
+		int i = NODE_LOWER_BOUND(x, k);
 		// hit!
 		if (i < x->n && k == NODE_KEY(x, i)) {
 			//cout << "hit on x=" << inf->ptr << ", i=" << inf->idx << endl;
@@ -497,12 +1452,140 @@ struct btree {
 		// continue to subtree.
 //        cerr << "search(): x:" << x
 //            << ", x.ptr[i]:" << NODE_PTR(x,i) << endl;
+		if (descent_willneed)
+			disk->prefetch(NODE_PTR(x, i));
 		node *y = disk_read(NODE_PTR(x, i));
 		return search(y, k);
 	}
 
+	// set the value of key k in place, an operation.
+	// return false if not found.
+	bool update(K k, V v)
+	{
+		disk->begin_op(true);
+		node *x = cow_root();
+		bool found = false;
+		while (x) {
+			int i = NODE_LOWER_BOUND(x, k);
+			if (i < x->n && k == NODE_KEY(x, i)) {
+				NODE_VAL(x, i) = v;
+				disk_write(x);
+				found = true;
+				break;
+			}
+			if (x->leaf)
+				break;
+			x = cow_child(x, i);
+		}
+		disk->end_op();
+		return found;
+	}
+
+#define MULTI_GROUP 16 // lookups in flight.
+
+    // madvise(WILLNEED) every node of a multi_search() level, for an
+    // index not in the page cache; a syscall per node otherwise wasted.
+    bool multi_willneed;
+    // madvise(WILLNEED) the child a search or insert goes down to,
+    // before it is read.
+    bool descent_willneed;
+
+	// search n keys, out[j]: value of keys[j], NULL if not found.
+	// a group of lookups goes down a level at a time: the pages (if
+	// multi_willneed), node headers, then the keys of the whole group
+	// are prefetched before any node of the level is searched, so the
+	// cache misses and page faults of the group overlap.
+	// with a buffer pool, a node is read(pinned) once per lookup of a
+	// level and unpinned when the lookup goes below it; the node of
+	// every value found stays pinned till the next operation, at most
+	// multi_budget() of them: the keys after are left to the next call.
+	// return the keys looked up, from the first; a node not read (but
+	// for a checksum mismatch, a miss) sets last_error, and the keys
+	// from its group on are not looked up.
+	size_t multi_search(const K *keys, size_t n, V **out)
+	{
+		u64 idx[MULTI_GROUP];
+		node *cur[MULTI_GROUP];
+		size_t pinned = 0, budget = multi_budget();
+		disk->begin_op(false);
+		for (size_t b = 0; b < n; b += MULTI_GROUP) {
+			const K *k = keys + b;
+			V **o = out + b;
+			int m = n - b < MULTI_GROUP ? n - b : MULTI_GROUP;
+			if (b && pinned + m > budget)
+				return b;
+			int live = m;
+			for (int j = 0; j < m; j++)
+				idx[j] = ROOT_NODE_INDEX;
+			while (live) {
+				if (multi_willneed)
+					for (int j = 0; j < m; j++)
+						if (idx[j])
+							disk->prefetch(idx[j]);
+				for (int j = 0; j < m; j++) {
+					if (!idx[j])
+						continue;
+					u64 bad = disk->verify_err;
+					cur[j] = disk_read(idx[j]);
+					if (cur[j] == NULL && disk->verify_err == bad) {
+						cerr << __func__ << "(): fail to read node " << idx[j]
+							<< ", " << pinned << " nodes of values pinned."
+							<< endl;
+						last_error = BTREE_READ_FAILED;
+						return b;
+					}
+					__builtin_prefetch(cur[j]);
+				}
+				for (int j = 0; j < m; j++)
+					if (idx[j] && cur[j])
+						key_prefetch<K>(NODE_KEYS(cur[j]), sizeof(item),
+								cur[j]->n);
+				for (int j = 0; j < m; j++) {
+					if (!idx[j])
+						continue;
+					node *x = cur[j];
+					int i = x ? NODE_LOWER_BOUND(x, k[j]) : 0;
+					if (x == NULL) { // checksum mismatch.
+						o[j] = NULL;
+						idx[j] = 0;
+						live--;
+					}
+					else if (i < x->n && k[j] == NODE_KEY(x, i)) {
+						o[j] = &NODE_VAL(x, i); // x stays pinned.
+						pinned++;
+						idx[j] = 0;
+						live--;
+					}
+					else if (x->leaf) {
+						o[j] = NULL;
+						idx[j] = 0;
+						live--;
+						disk->unpin(x);
+					}
+					else {
+						idx[j] = NODE_PTR(x, i);
+						disk->unpin(x);
+					}
+				}
+			}
+		}
+		return n;
+	}
+
+	// values multi_search() may keep pinned: the pool but POOL_MIN_FRAMES
+	// frames for the descents and evictions, a group at least.
+	size_t multi_budget()
+	{
+		if (disk->pool == NULL)
+			return (size_t)-1;
+		u64 f = disk->pool->frame_count();
+		return f > POOL_MIN_FRAMES + MULTI_GROUP ? f - POOL_MIN_FRAMES
+			: MULTI_GROUP;
+	}
+
 	// erase the max item in node x.
-	// return the (leaf)node that hold the max item.
+	// return the (leaf)node that hold the max item, NULL if a copy
+	// failed.
 	// the max item be deleted after this call.
 	node *erase_max(node *x)
 	{
@@ -510,23 +1593,35 @@ struct btree {
 			if (x->n == 0)
 				return NULL;
 			x->n--;
+			disk_write(x);
 			return x;
 		}
-		node *y = disk_read(NODE_LAST_PTR(x));
-		fixup(x, x->n - 1); // on last item.
+		// on last item, may concate the last child: copy it after.
+		if (!fixup(x, x->n - 1))
+			return NULL;
+		node *y = cow_child(x, x->n);
+		if (y == NULL)
+			return NULL;
 		return erase_max(y);
 	}
 
 	void erase(K k)
 	{
-		erase(root, k);
+		disk->begin_op(true);
+		right_depth = 0;
+		right_has_max = false;
+		node *x = cow_root();
+		if (x)
+			erase(x, k);
 		// strip empty root node.
 		// tree_height--
-		if (root->n == 0) {
-			node *r = NODE_FIRST_PTR(root);
+		if (root->n == 0 && !root->leaf) {
+			node *r = disk_read(NODE_FIRST_PTR(root));
 			free_node(root);
 			root = r;
+			disk->hdr->set_root(NODE2IDX(root));
 		}
+		disk->end_op();
 	}
 
 #ifdef PROFILE
@@ -538,7 +1633,9 @@ struct btree {
 	// recursive version.
 	// analog to search.
 	// search & delete from the root node.
-	void erase(node *x, K k)
+	// return false if a copy failed: the tree stays valid, but k may
+	// be left in it, and a node of the path underfull.
+	bool erase(node *x, K k)
 	{
 #ifdef PROFILE
 		erase_cnt++;
@@ -552,29 +1649,30 @@ struct btree {
 		//	cerr << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<" << endl << endl;
 		//}
 
-		int i = 0;
 		// 1 search for key k.
-		while (i < x->n && k > NODE_KEY(x, i))
-			i++;
+		int i = NODE_LOWER_BOUND(x, k);
 		// hit.
-		if (k == NODE_KEY(x, i)) {
+		if (i < x->n && k == NODE_KEY(x, i)) {
 			if (x->leaf) {
 				// 1 Erase item on leaf node.
 				for (int j = i; j <= x->n - 1; j++) // last ptr of x included.
 					NODE_ITEM(x, j) = NODE_ITEM(x, j + 1);
 				x->n--;
+				disk_write(x);
 				// FIXUP: node x may underflow.
-				return;
+				return true;
 			}
 			else {
 				// 2.a Erase item on internal node.
 				// Find predecessor/successor of item i, then apply cut&paste.
 				node *y, *p;
-				y = disk_read(NODE_PTR(x, i));
-				p = erase_max(y); // copy, Find predecessor
-				assert(p != NULL);
+				y = cow_child(x, i);
+				p = y ? erase_max(y) : NULL; // copy, Find predecessor
+				if (p == NULL)
+					return false;
 				assert(p->leaf); // erase on leaf.
 				NODE_KVP(x, i) = NODE_KVP(p, p->n); // paste, the latest deleted kvp in p. 
+				disk_write(x);
 			}
 		}
 		else { // if (k <> NODE_KEY(x, i)) {
@@ -583,15 +1681,15 @@ struct btree {
 				cout << "Key=" << k << " not found on:" << endl;
 				dump_node(x);
 				search_miss_cnt++;
-				return;
+				return true;
 			}
 			// continue to subtree.
-			node *z = disk_read(NODE_PTR(x, i)); // last ptr of x.
-			assert(z != NULL);
-			erase(z, k);
+			node *z = cow_child(x, i); // last ptr of x.
+			if (z == NULL || !erase(z, k))
+				return false;
 		}
 
-		fixup(x, i);
+		return fixup(x, i);
 	}
 
 #ifdef PROFILE
@@ -599,7 +1697,8 @@ struct btree {
 #endif // PROFILE
 
 	// fix subtree at item i.
-	void fixup(node *x, int i)
+	// return false if a copy failed, x and its children left as were.
+	bool fixup(node *x, int i)
 	{
 		assert(!x->leaf);
 		assert(i <= x->n);
@@ -620,12 +1719,13 @@ struct btree {
 		if (y->n < t-1 || z->n < t-1) { // < t - 1 ?
 			int tn = y->n + z->n;
 			if (tn < 2 * t-1) { // one more for median.
-				concate(x, i); // y += median + z.
+				return concate(x, i); // y += median + z.
 			}
 			else {
-				rebalance(x, i);
+				return rebalance(x, i);
 			}
 		}
+		return true;
 	}
 
 #ifdef PROFILE
@@ -637,14 +1737,16 @@ struct btree {
 	// rebalance of node y, z:
 	// rebalancing of left and right subtree of item i,
 	// equally distribute items among node y and z.
-	void rebalance(node *x, int i)
+	bool rebalance(node *x, int i)
 	{
 #ifdef PROFILE
 		rebalance_cnt++;
 #endif // PROFILE
 
-		node *y = disk_read(NODE_PTR(x, i));
-		node *z = disk_read(NODE_PTR(x, i+1));
+		node *y = cow_child(x, i);
+		node *z = y ? cow_child(x, i+1) : NULL;
+		if (z == NULL)
+			return false;
 		int tn, an, nz, ny;
 		tn = y->n + z->n; // total
 		an = tn / 2;      // average
@@ -700,6 +1802,7 @@ struct btree {
 		disk_write(x);
 
 		//cerr << "after concate: ny=" << y->n << ", nz=" << z->n << endl;
+		return true;
 	}
 
 #ifdef PROFILE
@@ -709,14 +1812,16 @@ struct btree {
 #endif // PROFILE
 
 	// concatenate node y, z with separator in x.
-	void concate(node *x, int i)
+	bool concate(node *x, int i)
 	{
 #ifdef PROFILE
 		concate_cnt++;
 #endif // PROFILE
 
-		node *y = disk_read(NODE_PTR(x, i));
-		node *z = disk_read(NODE_PTR(x, i + 1));
+		node *y = cow_child(x, i);
+		node *z = y ? cow_child(x, i + 1) : NULL;
+		if (z == NULL)
+			return false;
 
 #ifdef PROFILE
 		if (y->leaf)
@@ -736,7 +1841,7 @@ struct btree {
 		// remove item i from x.
 		for (int j = i; j < x->n; j++)
 			NODE_ITEM(x, j) = NODE_ITEM(x, j + 1); // last ptr of x included.
-		NODE_PTR(x, i) = y; // fix
+		set_child_node(x, i, y); // fix
 		x->n--;
 		y->n = y->n + 1 + z->n;
 		free_node(z);
@@ -751,6 +1856,7 @@ struct btree {
 		disk_write(x);
 		disk_write(y);
 		//disk_write(z);
+		return true;
 	}
 
 };
@@ -761,7 +1867,7 @@ struct btree {
 struct value_info {
     u64 offset;
     u32 size;
-}__attribute__((packed,aligned(4)));
+}__attribute__((packed)); // may be unaligned in a node.
 
 #pragma pack(1)
 // size: 12-byte ?
@@ -771,23 +1877,454 @@ struct value_info1 {
 };
 #pragma pack()
 
-int
-main()
+// random lookups of the multi-get benchmark, at most.
+#define MULTI_LOOKUPS (5 * 1000 * 1000)
+
+static void usage(const char *prog)
+{
+    cerr << "usage: " << prog
+         << " [-n keys] [-b] [-f fill] [-s split] [-r ratio] [-a]"
+         << " [-m batch] [-w] [-k] [-p] [-c] [-P page] [-V version]"
+         << " [-M mb] [-D] [-L window] [-S] [-F] [-u updates] [-C n]"
+         << " [-e erases]"
+         << " [-O batch] [-K verify] [-R] [-W] [-H] [-I depth] [-T n]"
+         << " [-X layout] [-Z threads] [-v]" << endl
+         << "  -n keys:  keys to insert into a new index." << endl
+         << "  -b:       bulk load the keys instead of inserting." << endl
+         << "  -f fill:  bulk load fill factor, (0, 1]." << endl
+         << "  -s split: split policy, even, append or auto(default)." << endl
+         << "  -r ratio: items kept in the left node by a biased split,"
+         << " of max items, 1 for an empty right node(default)." << endl
+         << "  -a:       no append fast path, descend from the root." << endl
+         << "  -m batch: random lookups by multi-get of batch keys,"
+         << " 0 for none, 128 by default." << endl
+         << "  -w:       madvise(WILLNEED) the nodes of a multi-get, of a"
+         << " warmup level." << endl
+         << "  -W:       madvise(WILLNEED) the child of a search or insert"
+         << " before going down." << endl
+         << "  -R:       no readahead of the index(MADV_RANDOM)." << endl
+         << "  -k:       insert the keys in random order." << endl
+         << "  -p:       no placement hint, new nodes at the first free"
+         << " inode." << endl
+         << "  -c:       cold cache, drop the index pages before every"
+         << " search loop." << endl
+         << "  -P page:  page size of a new index, 4K(default), 8K, 16K,"
+         << " 32K or 64K (4 .. 64 in K)." << endl
+         << "  -V ver:   format of a new index, 1: up to 1M nodes, u32"
+         << " child pointers, 2(default): 40-bit ones." << endl
+         << "  -M mb:    pread/pwrite the index thru a buffer pool of mb"
+         << " megabytes, 0 for mmap(default)." << endl
+         << "  -D:       O_DIRECT buffer pool reads and writes." << endl
+         << "  -H:       huge pages: buffer pool frames on 2M pages,"
+         << " else MADV_HUGEPAGE on the mapped index." << endl
+         << "  -L window: redo log, synced once every window inserts"
+         << " (group commit)." << endl
+         << "  -S:       no log, checkpoint the index after every insert."
+         << endl
+         << "  -F:       no log, a checkpoint msyncs the whole index, not"
+         << " only the pages changed." << endl
+         << "  -u n:     update the values of n random keys at the end."
+         << endl
+         << "  -C n:     checkpoint every n updates, 1000 by default." << endl
+         << "  -e n:     erase n random keys at the end, then look up"
+         << " every key." << endl
+         << "  -O batch: shadow paging, copy the nodes changed, a new root"
+         << " committed every batch inserts." << endl
+         << "  -K mode:  check node checksums on read, off(default),"
+         << " first(first read of a page) or always." << endl
+         << "  -I depth: warmup at open, load and lock the top depth"
+         << " levels, 0 for every level above the leaves." << endl
+         << "  -T n:     restart, n random lookups on a cold cache"
+         << " first, time to steady state." << endl
+         << "  -X layout: compact the index and exit: items repacked at"
+         << " the fill factor(-f), nodes rewritten in bfs or veb order,"
+         << " then swapped in; mmap only(no -M, -L, -O)." << endl
+         << "  -Z threads: check the index and exit: tree invariants,"
+         << " bitmap, a report per level; -c from a cold cache, -w"
+         << " idx.bin madvise(WILLNEED)d first." << endl
+         << "  -v:       echo every key." << endl;
+}
+
+// page faults of this process so far.
+static void page_faults(long &major, long &minor)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    major = ru.ru_majflt;
+    minor = ru.ru_minflt;
+}
+
+// page faults since major, minor of page_faults(), of n lookups.
+static void print_faults(long major, long minor, u32 n)
+{
+    long ma, mi;
+    page_faults(ma, mi);
+    cout << "page faults, major: " << ma - major
+         << ", minor: " << mi - minor
+         << ", major per lookup: " << std::fixed << std::setprecision(3)
+         << (n ? (double)(ma - major) / n : 0) << std::defaultfloat << endl;
+}
+
+// cpu time and dTLB misses(if counted) of n lookups, per lookup.
+static void print_lookups(double sec, perf_counter &tlb, u64 misses, u32 n)
+{
+    cout << "time for every lookup(sec): " << sec / n
+         << ", dTLB misses per lookup: ";
+    if (tlb.ok())
+        cout << (double)misses / n << endl;
+    else
+        cout << "n/a" << endl;
+}
+
+// value of the object following last.
+static value_info next_value(value_info last)
+{
+    u32 size = 30*1024;
+    u32 diff = (rand() % (20*1024)) & ~0x7; // align to 8-byte.
+    value_info v = {last.offset + last.size, size + diff};
+    return v;
+}
+
+// db options, see usage().
+struct db_opts {
+    u32 max_key;
+    bool bulk, verbose, append_fast, willneed, shuffle, place_hint, cold;
+    bool descent_willneed, random_access;
+    u32 pool_mb;
+    bool direct, huge_pages;
+    u32 wal_window;
+    bool sync_each, flush_whole;
+    u32 updates, ckpt_every;
+    u32 erases;
+    u32 shadow_batch;
+    u32 verify;
+    int warmup;   // levels, -1: none.
+    u32 restart;  // lookups after a restart.
+    int batch;
+    double fill, ratio;
+    int split;
+    int compact;  // layout of a compaction, 0: none.
+    int fsck;     // threads of a check, 0: none.
+};
+
+// lookups in a window of run_restart().
+#define RESTART_WINDOW 10000
+
+// random lookups right after a restart: the index pages dropped from
+// the page cache, the warmup(if any), then o.restart lookups in
+// windows of RESTART_WINDOW. steady state: from the first window of
+// a mean latency within 10% of the last one.
+template <class tree>
+static void run_restart(tree *t, const db_opts &o)
+{
+    u32 n = o.restart, windows = (n + RESTART_WINDOW - 1) / RESTART_WINDOW;
+    std::vector<double> lat(n), end(windows);
+    long majflt, minflt;
+
+    cout << "restart: " << n << " random lookups, cold cache, windows of "
+         << RESTART_WINDOW << "..." << endl;
+    t->disk->drop_cache();
+    page_faults(majflt, minflt);
+    double w_start = wall_sec(), w_warm = 0;
+    if (o.warmup >= 0) {
+        u64 locked = t->warmup(o.warmup, o.willneed);
+        w_warm = wall_sec() - w_start;
+        cout << "warmup: " << locked << " nodes locked, " << w_warm
+             << " seconds." << endl;
+    }
+    u32 miss = 0;
+    for (u32 i = 0; i < n; i++) {
+        double w = wall_sec();
+        if (t->search(rand() % o.max_key + 1) == NULL)
+            miss++;
+        double w2 = wall_sec();
+        lat[i] = w2 - w;
+        if ((i + 1) % RESTART_WINDOW == 0 || i + 1 == n)
+            end[i / RESTART_WINDOW] = w2 - w_start;
+    }
+    print_faults(majflt, minflt, n);
+    cout << "miss: " << miss << endl;
+
+    // mean and p99 latency of window w.
+    std::vector<double> mean(windows);
+    for (u32 w = 0; w < windows; w++) {
+        double sum = 0;
+        u32 last = std::min(n, (w + 1) * RESTART_WINDOW);
+        for (u32 i = w * RESTART_WINDOW; i < last; i++)
+            sum += lat[i];
+        mean[w] = sum / (last - w * RESTART_WINDOW);
+    }
+    u32 steady = 0;
+    while (steady < windows && mean[steady] > 1.1 * mean[windows - 1])
+        steady++;
+    double p99[2];
+    for (int j = 0; j < 2; j++) {
+        u32 w = j ? windows - 1 : 0;
+        u32 last = std::min(n, (w + 1) * RESTART_WINDOW);
+        std::vector<double> v(lat.begin() + w * RESTART_WINDOW,
+                lat.begin() + last);
+        std::nth_element(v.begin(), v.begin() + v.size() * 99 / 100, v.end());
+        p99[j] = v[v.size() * 99 / 100];
+    }
+    cout << "mean latency(sec), first window: " << mean[0]
+         << ", last window: " << mean[windows - 1] << endl;
+    cout << "p99 latency(sec), first window: " << p99[0]
+         << ", last window: " << p99[1] << endl;
+    cout << "time to steady state(sec): "
+         << (steady ? end[steady - 1] : w_warm) << ", lookups: "
+         << steady * RESTART_WINDOW << endl;
+}
+
+// lookups before and after a compaction, if not given by -T.
+#define COMPACT_LOOKUPS 100000
+
+// the index files of the disk_maps created from now on, hdr.bin,
+// idx.bin and wal.bin with suffix. fresh: removed first.
+static void index_files(const char *suffix, bool fresh = false)
+{
+    static std::string names[3];
+    const char *base[3] = {"hdr.bin", "idx.bin", "wal.bin"};
+    for (int i = 0; i < 3; i++) {
+        names[i] = std::string(base[i]) + suffix;
+        if (fresh)
+            unlink(names[i].c_str());
+    }
+    disk_map::index_header_file_name = names[0].c_str();
+    disk_map::index_inode_file_name = names[1].c_str();
+    disk_map::index_log_file_name = names[2].c_str();
+}
+
+static u64 file_bytes(const char *file)
+{
+    struct stat st;
+    return stat(file, &st) ? 0 : st.st_size;
+}
+
+// an index of 8-byte node headers, h its header: its items bulk
+// loaded at the fill factor into index *.new, of checksummed nodes,
+// then swapped in for it.
+template <u32 P, class PTR>
+static int run_convert(const db_opts &o, const index_header &h)
+{
+    typedef btree<u32, value_info, P, PTR> tree;
+
+    // the tree of the last shadow commit, as the index is opened.
+    int s = h.last_slot();
+    u64 root = s < 0 ? h.root() : h.slot[s].root;
+    u64 nodes = s < 0 ? h.nodes() : h.slot[s].nodes;
+    cout << "convert: " << nodes << " nodes of " << INODE_HEADER_SIZE_V0
+         << "-byte headers, root " << root << endl;
+    int fd = open(disk_map::index_inode_file_name, O_RDONLY);
+    if (fd == -1) {
+        cerr << "convert: fail to open " << disk_map::index_inode_file_name
+             << endl;
+        return -1;
+    }
+    double w = wall_sec();
+    index_files(".new", true);
+    tree *c = new tree(o.split, o.ratio);
+    u64 bad = 0;
+    c->bulk_load(typename tree::v0_iterator(fd, root, &bad),
+            typename tree::v0_iterator(), o.fill);
+    u64 items = c->item_count();
+    bool ok = !bad && !c->last_error;
+    cout << "converted: " << items << " items, " << c->disk->hdr->nodes()
+         << " nodes(fill " << o.fill << "), " << wall_sec() - w
+         << " seconds." << endl;
+    delete c;
+    close(fd);
+    if (!ok) {
+        cerr << "convert: " << bad << " pages not read, the index is"
+             << " unchanged." << endl;
+        index_files(".new", true);
+        index_files("");
+        return -1;
+    }
+    index_files("");
+    return disk_map::replace(".new") ? 0 : -1;
+}
+
+// offline compaction of the index: its items repacked at the fill
+// factor by a bulk load into index *.pack, whose nodes are copied in
+// order of layout o.compact into index *.new, then swapped in for the
+// index. cold lookups before and after. an index of 8-byte node
+// headers is converted instead, see run_convert().
+template <u32 P, class PTR>
+static int run_compact(const db_opts &o)
+{
+    typedef btree<u32, value_info, P, PTR> tree;
+    const char *layout = o.compact == LAYOUT_VEB ? "veb" : "bfs";
+
+    // mmap, written in place, as of the header of the index.
+    disk_map::pool_pages = 0;
+    disk_map::random_access = o.random_access;
+    disk_map::wal_window = 0;
+    disk_map::sync_each = false;
+    disk_map::shadow_batch = 0;
+    disk_map::verify_mode = o.verify;
+
+    index_header h;
+    if (disk_map::read_header(disk_map::index_header_file_name, h) &&
+            h.node_header != INODE_HEADER_SIZE)
+        return run_convert<P, PTR>(o, h);
+
+    tree *t = new tree(o.split, o.ratio);
+    u64 nodes = t->disk->hdr->nodes(), bytes = file_bytes("idx.bin");
+    u64 items = t->item_count();
+    cout << "compact: " << nodes << " nodes, height " << t->height()
+         << ", " << items << " items, idx.bin " << bytes << " bytes." << endl;
+    if (items == 0) {
+        delete t;
+        return 0;
+    }
+    // keys of a db index: 1 .. items.
+    db_opts r = o;
+    r.max_key = items;
+    if (r.restart == 0)
+        r.restart = COMPACT_LOOKUPS;
+    srand(1);
+    run_restart(t, r);
+
+    double w = wall_sec();
+    index_files(".pack", true);
+    tree *packed = new tree(o.split, o.ratio);
+    packed->bulk_load(t->scan_begin(), t->scan_end(), o.fill);
+    double w_pack = wall_sec() - w;
+    index_files(".new", true);
+    tree *c = new tree(o.split, o.ratio);
+    u64 copied = packed->last_error ? 0 : c->copy_from(*packed, o.compact);
+    bool ok = copied && c->item_count() == items;
+    cout << "repack(fill " << o.fill << "): " << w_pack << " seconds, "
+         << layout << " layout: " << copied << " nodes, "
+         << wall_sec() - w - w_pack << " seconds." << endl;
+    delete c;
+    delete packed;
+    delete t;
+    index_files(".pack", true); // removed.
+    if (!ok) {
+        cerr << "compact: copy failed, the index is unchanged." << endl;
+        index_files(".new", true);
+        index_files("");
+        return -1;
+    }
+    index_files("");
+    if (!disk_map::replace(".new"))
+        return -1;
+
+    t = new tree(o.split, o.ratio);
+    cout << "compacted: nodes " << nodes << " -> " << t->disk->hdr->nodes()
+         << ", idx.bin bytes " << bytes << " -> " << file_bytes("idx.bin")
+         << endl;
+    srand(1);
+    run_restart(t, r);
+    delete t;
+    return 0;
+}
+
+// seconds to read idx.bin from start to end, 1M at a time, from a
+// cold cache: the bandwidth a check may get to.
+static double read_seq(disk_map *disk)
+{
+    std::vector<char> buf(SZ_1K * SZ_1K);
+    disk->drop_cache();
+    double w = wall_sec();
+    for (u64 off = 0; off < disk->map_len_file; off += buf.size())
+        if (pread(disk->fd_idx, &buf[0], buf.size(), off) <= 0)
+            break;
+    w = wall_sec() - w;
+    disk->drop_cache();
+    return w;
+}
+
+// check the index by o.fsck threads, see btree::fsck(); cold: from a
+// cold cache, against a sequential read of idx.bin.
+template <u32 P, class PTR>
+static int run_fsck(const db_opts &o)
+{
+    typedef btree<u32, value_info, P, PTR> tree;
+
+    // mmap, as of the header of the index; the files not written, a
+    // redo log not replayed but reported.
+    disk_map::read_only = true;
+    disk_map::pool_pages = 0;
+    disk_map::random_access = o.random_access;
+    disk_map::wal_window = 0;
+    disk_map::shadow_batch = 0;
+    disk_map::verify_mode = VERIFY_OFF;
+
+    tree *t = new tree(o.split, o.ratio);
+    double mb = (double)t->disk->map_len_file / SZ_1K / SZ_1K;
+    if (o.cold) {
+        double w = read_seq(t->disk);
+        cout << "sequential read: " << mb << " MB, " << w << " seconds, "
+             << mb / w << " MB/s" << endl;
+    }
+    long majflt, minflt;
+    page_faults(majflt, minflt);
+    double w = wall_sec();
+    u64 errors = t->fsck(o.fsck, o.willneed);
+    w = wall_sec() - w;
+    long ma, mi;
+    page_faults(ma, mi);
+    cout << "page faults, major: " << ma - majflt << ", minor: "
+         << mi - minflt << endl;
+    cout << "fsck: " << mb << " MB, " << w << " seconds, " << mb / w
+         << " MB/s" << endl;
+    delete t;
+    return errors ? 1 : 0;
+}
+
+// the db run on an index of P-byte pages, PTR child pointers.
+template <u32 P, class PTR>
+static int run_db(const db_opts &o)
 {
     Timer timer;
 
+    u32 last_key, max_key = o.max_key;
+    bool bulk = o.bulk, verbose = o.verbose;
+    bool append_fast = o.append_fast, willneed = o.willneed;
+    bool shuffle = o.shuffle, place_hint = o.place_hint, cold = o.cold;
+    int batch = o.batch;
+    double fill = o.fill, ratio = o.ratio;
+    int split = o.split;
+
+    cout << "page size: " << P << ", ptr size: " << sizeof(PTR) << endl;
+    // the backend of the disk_map of the tree.
+    disk_map::pool_pages = (u64)o.pool_mb * SZ_1K * SZ_1K / P;
+    disk_map::pool_direct = o.direct;
+    disk_map::huge_pages = o.huge_pages;
+    disk_map::random_access = o.random_access;
+    disk_map::wal_window = o.wal_window;
+    disk_map::sync_each = o.sync_each;
+    disk_map::flush_whole = o.flush_whole;
+    disk_map::shadow_batch = o.shadow_batch;
+    disk_map::verify_mode = o.verify;
     cout << "value_info size:" << sizeof(value_info) << endl; 
     assert(sizeof(value_info) == 12);
 
-    typedef btree<u32, value_info> tree;
-    tree *t = new tree();
-    cout << "tree node item size:" << sizeof(tree::item) << endl; 
+    typedef btree<u32, value_info, P, PTR> tree;
+    tree *t = new tree(split, ratio);
+    t->append_fast = append_fast;
+    t->multi_willneed = willneed;
+    t->descent_willneed = o.descent_willneed;
+    t->place_hint = place_hint;
+    cout << "tree node item size:" << sizeof(typename tree::item) << endl; 
+
+    // a restart of an index: lookups from a cold cache; else the top
+    // levels loaded now, if asked.
+    if (o.restart && t->root->n)
+        run_restart(t, o);
+    else if (o.warmup >= 0) {
+        double w = wall_sec();
+        u64 locked = t->warmup(o.warmup, willneed);
+        cout << "warmup: " << locked << " nodes locked, " << wall_sec() - w
+             << " seconds." << endl;
+    }
 
-    u32 last_key, max_key = 10000 * 1000 * 5 + 10000;//10000;
     value_info last_val = {0, 0};
     // 0, 30*1024
 
-    tree::item *it = t->get_min_item();
+    typename tree::item *it = t->get_min_item();
     if (it) {
         // get min item in node.
         cout << "FIRST key: " << it->k
@@ -799,51 +2336,109 @@ main()
     } else {
         cout << "Do add new nodes." << endl;
         srand(time(0));
-        u32 step = 20*1024;
-        u32 size = 30*1024;
-        u32 diff = (rand() % step) & ~0x7; // align to 8-byte.
-
-        cout << endl;
-        timer.Start();
-        for (   last_key=1; !t->last_error && last_key <= max_key;
-                last_key++) {
-            last_val.offset += last_val.size;
-            diff = (rand() % (20*1024)) & ~0x7; // align to 8-byte.
-            last_val.size = size + diff; 
-            tree::key_val kv = {last_key, last_val};
-            cout << "\r  key: " << std::setw(10) << last_key
-                 << ", v.ofs: " << std::setw(15) << last_val.offset
-                 << ", v.siz: " << std::setw(6)  << last_val.size
-                 << " "; // << endl;
 
-            t->insert(kv);
+        if (bulk) {
+            std::vector<typename tree::key_val> kvs(max_key);
+            for (last_key=1; last_key <= max_key; last_key++) {
+                last_val = next_value(last_val);
+                typename tree::key_val kv = {last_key, last_val};
+                kvs[last_key-1] = kv;
+            }
+            cout << "bulk loading " << max_key
+                 << " keys, fill factor: " << fill << endl;
+            timer.Start();
+            t->bulk_load(kvs.begin(), kvs.end(), fill);
+            double t_load = timer.Stop();
+            cout << "bulk load terminated!" << endl;
+            cout << "take " << t_load << " seconds." << endl;
+        } else {
+            // insertion order of the keys 1..max_key, if shuffled.
+            std::vector<u32> keys(shuffle ? max_key : 0);
+            for (u32 i = 0; i < keys.size(); i++)
+                keys[i] = i + 1;
+            random_shuffle(keys.begin(), keys.end());
+            cout << "insert " << max_key << " keys in "
+                 << (shuffle ? "random" : "ascending") << " order, "
+                 << (place_hint ? "with" : "no") << " placement hint" << endl;
+            cout << endl;
+            timer.Start();
+            double w_start = wall_sec();
+            for (u32 i = 0; !t->last_error && i < max_key; i++) {
+                last_key = shuffle ? keys[i] : i + 1;
+                last_val = next_value(last_val);
+                typename tree::key_val kv = {last_key, last_val};
+                if (verbose)
+                    cout << "\r  key: " << std::setw(10) << last_key
+                         << ", v.ofs: " << std::setw(15) << last_val.offset
+                         << ", v.siz: " << std::setw(6)  << last_val.size
+                         << " "; // << endl;
+
+                t->insert(kv);
+            }
+            cout << endl;
+            double t_insert = timer.Stop();
+            double w_insert = wall_sec() - w_start;
+            cout << "insertion loop terminated!" << endl;
+            cout << "take " << t_insert << " seconds." << endl;
+            // waits for the disk too, not only cpu time.
+            cout << "wall time: " << w_insert << " seconds." << endl;
+            cout << "inserts per second: " << (u64)(max_key / w_insert) << endl;
+            cout << "append fast path: " << t->append_fast_cnt << endl;
+            if (redo_log *wal = t->disk->wal)
+                cout << "redo log: " << wal->commit_cnt << " commits, "
+                     << wal->sync_cnt << " syncs, " << wal->byte_cnt
+                     << " bytes" << endl;
+            if (t->disk->shadow)
+                cout << "shadow commits: " << t->disk->shadow_cnt
+                     << ", pages written: " << t->disk->ckpt_pages << endl;
         }
-        cout << endl;
-        double t_insert = timer.Stop();
-        cout << "insertion loop terminated!" << endl;
-        cout << "take " << t_insert << " seconds." << endl;
+    }
+
+    if (t->last_error) {
+        cerr << "load failed, error " << t->last_error << endl;
+        delete t;
+        return -1;
     }
 
     cout << "root item: " << endl;
     for (int i=0; i < t->root->n; ++i) {
-        tree::item it = NODE_ITEM(t->root, i);
+        typename tree::item it = NODE_ITEM(t->root, i);
         cout << "#" << i+1 << " k:" << it.k
              << " v.ofs:" << it.v.offset
              << endl;
     }
 
-    cout << "node count: 0x" << std::hex << t->node_count << endl;
-    cout << "node count: " << std::dec << t->node_count << endl;
+    // nodes of the whole index, not only those of this run.
+    u64 node_cnt = t->disk->hdr->nodes();
+    cout << "node count: 0x" << std::hex << node_cnt << endl;
+    cout << "node count: " << std::dec << node_cnt << endl;
 
     u64 item_cnt = t->item_count();
     cout << "item count: " << item_cnt << endl;
 
-    cout << "items per node: " << item_cnt / t->node_count << endl;
+    if (node_cnt) {
+        cout << "items per node: " << item_cnt / node_cnt << endl;
+        cout << "fill factor: " << std::fixed << std::setprecision(3)
+             << (double)item_cnt / ((double)node_cnt * (2 * t->t - 1))
+             << std::defaultfloat << endl;
+    }
+    cout << "height: " << t->height() << endl;
+    cout << "splits: " << t->split_cnt
+         << ", biased: " << t->split_biased_cnt << endl;
 
     assert(item_cnt == max_key);
 
+    if (cold) {
+        cout << "drop index pages from the page cache..." << endl;
+        t->disk->drop_cache();
+    }
+    long majflt, minflt;
+    page_faults(majflt, minflt);
+
+    perf_counter tlb;
     cout << "begin search..." << endl;
     timer.Start();
+    tlb.start();
     // search all keys.
     u32 search_hit = 0, search_miss = 0;
     for (last_key = 1; last_key <= max_key; last_key++) {
@@ -853,21 +2448,381 @@ main()
             search_miss++;
             cout << "\rsearch miss on key=" << last_key << " ";// << endl;
             //continue;
+            delete t;
             return -1;
         }
         search_hit++;
-        cout << "\r  key: " << std::setw(10) << last_key
-             << ", v.ofs: " << std::setw(15) << vp->offset
-             << ", v.siz: " << std::setw(6)  << vp->size
-             << " ";
+        if (verbose)
+            cout << "\r  key: " << std::setw(10) << last_key
+                 << ", v.ofs: " << std::setw(15) << vp->offset
+                 << ", v.siz: " << std::setw(6)  << vp->size
+                 << " ";
     } 
     cout << endl;
+    u64 tlb_search = tlb.stop();
     double t_search = timer.Stop();
     cout << "searching loop terminated!" << endl;
     cout << "take " << t_search << " seconds." << endl;
     cout << " hit:  " << search_hit
          << ",miss: " << search_miss<< endl;
+    print_lookups(t_search, tlb, tlb_search, max_key);
+    print_faults(majflt, minflt, max_key);
+    cout << "huge pages(K-bytes): " << huge_kb() << endl;
+    if (buffer_pool *bp = t->disk->pool) {
+        u64 pins = bp->hit_cnt + bp->miss_cnt;
+        cout << "buffer pool: " << bp->frame_count() << " pages, hit: "
+             << bp->hit_cnt << ", miss(read): " << bp->miss_cnt
+             << ", hit ratio: " << std::fixed << std::setprecision(4)
+             << (pins ? (double)bp->hit_cnt / pins : 0) << std::defaultfloat
+             << ", write: " << bp->write_cnt
+             << ", evict: " << bp->evict_cnt << endl;
+    }
+    if (o.verify)
+        cout << "node checksums(crc32c " << CRC32C_IMPL << "): "
+             << t->disk->verify_cnt << " checked, " << t->disk->verify_err
+             << " mismatches" << endl;
+
+    if (batch > 0) {
+        // random object ids, one by one and by batch.
+        u32 n_lookup = max_key < MULTI_LOOKUPS ? max_key : MULTI_LOOKUPS;
+        std::vector<u32> ids(n_lookup);
+        for (u32 i = 0; i < n_lookup; i++)
+            ids[i] = rand() % max_key + 1;
+
+        // every loop on a cold cache, if any.
+        if (cold)
+            t->disk->drop_cache();
+        page_faults(majflt, minflt);
+        cout << "random search " << n_lookup << " keys..." << endl;
+        timer.Start();
+        double w_start = wall_sec();
+        tlb.start();
+        search_miss = 0;
+        for (u32 i = 0; i < n_lookup; i++)
+            if (t->search(ids[i]) == NULL)
+                search_miss++;
+        u64 tlb_single = tlb.stop();
+        double t_single = timer.Stop();
+        cout << "take " << t_single << " seconds, miss: "
+             << search_miss << endl;
+        print_lookups(t_single, tlb, tlb_single, n_lookup);
+        cout << "wall time: " << wall_sec() - w_start << " seconds." << endl;
+        print_faults(majflt, minflt, n_lookup);
+
+        cout << "random multi-get " << n_lookup << " keys, batch of "
+             << batch << "..." << endl;
+        std::vector<value_info *> out(batch);
+        if (cold)
+            t->disk->drop_cache();
+        page_faults(majflt, minflt);
+        timer.Start();
+        w_start = wall_sec();
+        tlb.start();
+        search_miss = 0;
+        for (u32 i = 0; i < n_lookup && !t->last_error; ) {
+            u32 m = n_lookup - i < (u32)batch ? n_lookup - i : batch;
+            // fewer than m if the values found fill the pool.
+            size_t done = t->multi_search(&ids[i], m, &out[0]);
+            for (u32 j = 0; j < done; j++)
+                if (out[j] == NULL)
+                    search_miss++;
+            i += done;
+        }
+        if (t->last_error)
+            cerr << "multi-get failed, error " << t->last_error << endl;
+        u64 tlb_multi = tlb.stop();
+        double t_multi = timer.Stop();
+        cout << "take " << t_multi << " seconds, miss: "
+             << search_miss << endl;
+        print_lookups(t_multi, tlb, tlb_multi, n_lookup);
+        cout << "wall time: " << wall_sec() - w_start << " seconds." << endl;
+        print_faults(majflt, minflt, n_lookup);
+    }
 
+    if (o.updates > 0) {
+        // a new value for random keys, the pages changed checkpointed
+        // every ckpt_every updates.
+        u32 every = o.ckpt_every ? o.ckpt_every : 1000;
+        cout << "update " << o.updates << " random keys, checkpoint every "
+             << every << (o.flush_whole ? ", whole index msync" : "")
+             << "..." << endl;
+        t->disk->checkpoint();
+        u64 cnt0 = t->disk->ckpt_cnt, pages0 = t->disk->ckpt_pages;
+        u64 runs0 = t->disk->ckpt_runs;
+        double w_ckpt = 0, w_start = wall_sec();
+        for (u32 i = 1; i <= o.updates; i++) {
+            value_info v = next_value(last_val);
+            t->update(rand() % max_key + 1, v);
+            if (i % every == 0) {
+                double w = wall_sec();
+                t->disk->checkpoint();
+                w_ckpt += wall_sec() - w;
+            }
+        }
+        double w_update = wall_sec() - w_start;
+        u64 n_ckpt = t->disk->ckpt_cnt - cnt0;
+        cout << "take " << w_update << " seconds(wall)." << endl;
+        cout << "checkpoints: " << n_ckpt << ", pages: "
+             << t->disk->ckpt_pages - pages0 << ", runs: "
+             << t->disk->ckpt_runs - runs0 << endl;
+        if (n_ckpt)
+            cout << "time for every checkpoint(sec): " << w_ckpt / n_ckpt
+                 << endl;
+    }
+
+    if (o.erases > 0) {
+        // erase random keys, each once, then look up every key: an
+        // erased one misses, any other hits.
+        cout << "erase " << o.erases << " random keys..." << endl;
+        std::vector<bool> gone(max_key + 1);
+        u32 erased = 0;
+        double w_start = wall_sec();
+        for (u32 i = 0; i < o.erases && !t->last_error; i++) {
+            u32 k = rand() % max_key + 1;
+            if (gone[k])
+                continue;
+            t->erase(k);
+            gone[k] = true;
+            erased++;
+        }
+        cout << "take " << wall_sec() - w_start << " seconds(wall)." << endl;
+        if (t->last_error)
+            cerr << "erase failed, error " << t->last_error << endl;
+        u32 wrong = 0;
+        for (u32 k = 1; k <= max_key; k++)
+            if ((t->search(k) == NULL) != gone[k])
+                wrong++;
+        cout << "erased: " << erased << ", items: " << t->item_count()
+             << ", wrong lookups: " << wrong << endl;
+        if (wrong) {
+            delete t;
+            return -1;
+        }
+    }
+
+    delete t;
     return 0;
 }
 
+
+// v1 index: u32 child pointers, v2: 40-bit.
+template <u32 P>
+static int run_page(const db_opts &o, u32 version)
+{
+    if (version == 1) {
+        if (o.fsck)
+            return run_fsck<P, u32>(o);
+        return o.compact ? run_compact<P, u32>(o) : run_db<P, u32>(o);
+    }
+    if (o.fsck)
+        return run_fsck<P, u40>(o);
+    return o.compact ? run_compact<P, u40>(o) : run_db<P, u40>(o);
+}
+
+int
+main(int argc, char *argv[])
+{
+    u32 max_key = 10000 * 1000 * 5 + 10000;//10000;
+    u32 page_size = 0, version = 0; // 0: not set, the default.
+    bool bulk = false, verbose = false, append_fast = true, willneed = false;
+    bool shuffle = false, place_hint = true, cold = false, direct = false;
+    bool huge_pages = false;
+    bool sync_each = false, flush_whole = false;
+    bool descent_willneed = false, random_access = false;
+    u32 pool_mb = 0, wal_window = 0, updates = 0, ckpt_every = 0;
+    u32 erases = 0;
+    u32 shadow_batch = 0, verify = VERIFY_OFF, restart = 0;
+    int warmup = -1;
+    int batch = 128;
+    double fill = 1.0, ratio = 1.0;
+    int split = SPLIT_AUTO;
+#ifdef BTREE_COMPACT
+    int compact = LAYOUT_BFS; // btree-compact: db -X bfs.
+#else
+    int compact = 0;
+#endif
+#ifdef BTREE_FSCK
+    int fsck = std::thread::hardware_concurrency(); // btree-fsck: db -Z.
+    if (fsck < 1)
+        fsck = 1;
+#else
+    int fsck = 0;
+#endif
+    int opt;
+    while ((opt = getopt(argc, argv, "n:bf:s:r:am:wWRkpcP:V:M:DHL:SFu:C:e:O:K:I:T:X:Z:v")) != -1) {
+        switch (opt) {
+        case 'n':
+            max_key = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            bulk = true;
+            break;
+        case 'f':
+            fill = atof(optarg);
+            break;
+        case 's':
+            if (!strcmp(optarg, "even"))
+                split = SPLIT_EVEN;
+            else if (!strcmp(optarg, "append"))
+                split = SPLIT_APPEND;
+            else if (!strcmp(optarg, "auto"))
+                split = SPLIT_AUTO;
+            else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'r':
+            ratio = atof(optarg);
+            break;
+        case 'a':
+            append_fast = false;
+            break;
+        case 'm':
+            batch = atoi(optarg);
+            break;
+        case 'w':
+            willneed = true;
+            break;
+        case 'W':
+            descent_willneed = true;
+            break;
+        case 'R':
+            random_access = true;
+            break;
+        case 'k':
+            shuffle = true;
+            break;
+        case 'p':
+            place_hint = false;
+            break;
+        case 'c':
+            cold = true;
+            break;
+        case 'P':
+            page_size = strtoul(optarg, NULL, 0);
+            if (page_size <= 64) // in K.
+                page_size *= SZ_1K;
+            break;
+        case 'V':
+            version = atoi(optarg);
+            if (version != 1 && version != 2) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'M':
+            pool_mb = strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            direct = true;
+            break;
+        case 'H':
+            huge_pages = true;
+            break;
+        case 'L':
+            wal_window = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            sync_each = true;
+            break;
+        case 'F':
+            flush_whole = true;
+            break;
+        case 'u':
+            updates = strtoul(optarg, NULL, 0);
+            break;
+        case 'C':
+            ckpt_every = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            erases = strtoul(optarg, NULL, 0);
+            break;
+        case 'O':
+            shadow_batch = strtoul(optarg, NULL, 0);
+            break;
+        case 'K':
+            if (!strcmp(optarg, "off"))
+                verify = VERIFY_OFF;
+            else if (!strcmp(optarg, "first"))
+                verify = VERIFY_FIRST;
+            else if (!strcmp(optarg, "always"))
+                verify = VERIFY_ALWAYS;
+            else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'I':
+            warmup = atoi(optarg);
+            break;
+        case 'T':
+            restart = strtoul(optarg, NULL, 0);
+            break;
+        case 'Z':
+            fsck = atoi(optarg);
+            if (fsck < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'X':
+            if (!strcmp(optarg, "bfs"))
+                compact = LAYOUT_BFS;
+            else if (!strcmp(optarg, "veb"))
+                compact = LAYOUT_VEB;
+            else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    db_opts o = {max_key, bulk, verbose, append_fast, willneed,
+        shuffle, place_hint, cold, descent_willneed, random_access,
+        pool_mb, direct, huge_pages, wal_window, sync_each, flush_whole, updates,
+        ckpt_every, erases, shadow_batch, verify, warmup, restart, batch,
+        fill, ratio, split, compact, fsck};
+
+    // the header as of the last operation logged before a crash; fsck
+    // checks the files as they are.
+    if (!fsck && disk_map::recover() < 0)
+        return -1;
+
+    // an index keeps the page size and version it was created with.
+    index_header h;
+    if (disk_map::read_header(disk_map::index_header_file_name, h)) {
+        if ((page_size && page_size != h.page_size) ||
+                (version && version != h.version))
+            cerr << "index of version " << h.version << ", page size "
+                 << h.page_size << ", -V/-P ignored." << endl;
+        page_size = h.page_size;
+        version = h.version;
+    }
+    else if (compact || fsck) {
+        cerr << "no index to " << (fsck ? "check." : "compact.") << endl;
+        return -1;
+    }
+    if (page_size == 0)
+        page_size = SZ_4K;
+    if (version == 0)
+        version = INDEX_VERSION;
+
+    switch (page_size) {
+    case  4 * SZ_1K: return run_page< 4 * SZ_1K>(o, version);
+    case  8 * SZ_1K: return run_page< 8 * SZ_1K>(o, version);
+    case 16 * SZ_1K: return run_page<16 * SZ_1K>(o, version);
+    case 32 * SZ_1K: return run_page<32 * SZ_1K>(o, version);
+    case 64 * SZ_1K: return run_page<64 * SZ_1K>(o, version);
+    }
+    cerr << "unsupported page size: " << page_size << endl;
+    usage(argv[0]);
+    return -1;
+}
@@ -1,20 +1,64 @@
 #include <iostream>
 #include <cstdlib>
+#include <cstddef>
 #include <algorithm>
 #include <cassert>
 #include <iomanip>
+#include <vector>
+#include <thread>
 
 //#include "timer.hpp"
 #include "bench.hpp"
+#include "search.hpp"
+#include "arena.hpp"
 
 using namespace std;
 
 #define DEBUG 1
 #define PROFILE
 
+// node layouts.
+// LAYOUT_AOS: array of items, (child ptr, key, value) interleaved.
+// LAYOUT_SOA: keys, values and child ptrs in 3 separate arrays,
+//             so key search only touches the key cache lines.
+enum node_layout {
+	LAYOUT_AOS,
+	LAYOUT_SOA
+};
+
+// node allocators.
+// ALLOC_CALLOC:     calloc/free per node.
+// ALLOC_ARENA:      node_arena, cache line aligned blocks and free list.
+// ALLOC_ARENA_HUGE: node_arena on transparent huge pages.
+// ALLOC_ARENA_HUGETLB: node_arena on hugetlbfs pages (vm.nr_hugepages).
+enum node_alloc {
+	ALLOC_CALLOC,
+	ALLOC_ARENA,
+	ALLOC_ARENA_HUGE,
+	ALLOC_ARENA_HUGETLB
+};
+
+// pages of the node_arena of allocator alloc.
+inline int arena_pages(int alloc)
+{
+	return alloc == ALLOC_ARENA_HUGE ? ARENA_THP
+		: alloc == ALLOC_ARENA_HUGETLB ? ARENA_HUGETLB : ARENA_4K;
+}
+
+// node version latch of the concurrent mode, optimistic lock coupling:
+// bit 0:  obsolete, the node is freed.
+// bit 1:  locked by a writer.
+// bit 2-: version, one more on every unlock.
+#define OLC_OBSOLETE	1UL
+#define OLC_LOCKED	2UL
+#define OLC_BITS	3UL
+#define OLC_STEP	4UL
+
 // an in-memory B-Tree implementation.
+// T: fanout fixed at compile time, node loops get constant bounds and
+//    nodes a fixed size; 0 for the fanout t given at runtime.
 //TODO a disk-based B-Tree.
-template <class K, class V>
+template <class K, class V, node_layout L = LAYOUT_AOS, int T = 0>
 struct btree {
 
 	// Key-Value pair.
@@ -41,11 +85,19 @@ struct btree {
 		item() :c((node *) 0xDEADBEEF) {}
 	};
 
+	// items of node struct: node_capacity(T) if fixed,
+	// else 2 and allocate more latter.
+	enum { NODE_ITEMS = T > 0 ? 2 * T + 2 : 2 };
+
 	struct node {
 		bool leaf; // is leaf node?
 		int n; // keys in node
-		item items[2]; // allocate more latter.
+		// latch of the concurrent mode, see OLC_*, after the first
+		// word which a freed node lends to the arena free list.
+		unsigned long version;
+		item items[NODE_ITEMS];
 		//one more for last node ptr.
+		// LAYOUT_SOA: keys[], vals[], ptrs[] start at items.
 		node() :n(0) {}
 	};
 
@@ -56,21 +108,30 @@ struct btree {
 		item_info() :ptr(NULL), idx(0) {}
 		item_info(node *x_, int i_) :ptr(x_), idx(i_) {}
 	};
-#define NI_ITEM(x, i)	((x)->items[i])
-#define NI_PTR(x, i)	((x)->items[i].c)
-#define NI_KEY(x, i)	((x)->items[i].k)
-#define NI_VAL(x, i)	((x)->items[i].v)
-#define NI_KVP(x, i)	((x)->items[i].kv)
-
-#define NI_FIRST_ITEM(x) ((x)->items[0])
-#define NI_LAST_ITEM(x) ((x)->items[(x)->n - 1])
-#define NI_FIRST_PTR(x) ((x)->items[0].c)
-#define NI_LAST_PTR(x)  ((x)->items[(x)->n].c)
-#define NI_FIRST_KVP(x) ((x)->items[0].kv)
-#define NI_LAST_KVP(x)  ((x)->items[(x)->n - 1].kv)
-
-#define MIN_ITEMS (t - 1)
-#define MAX_ITEMS (2 * t - 1)
+#define NI_PTR(x, i)	(*ptr_at(x, i))
+#define NI_KEY(x, i)	(*key_at(x, i))
+#define NI_VAL(x, i)	(*val_at(x, i))
+
+#define NI_FIRST_PTR(x) NI_PTR(x, 0)
+#define NI_LAST_PTR(x)  NI_PTR(x, (x)->n)
+
+// item i of x = item j of y: key, value and child ptr.
+#define NI_MOVE_ITEM(x, i, y, j)	move_item(x, i, y, j)
+// key and value only.
+#define NI_MOVE_KVP(x, i, y, j)	move_kvp(x, i, y, j)
+#define NI_SET_KVP(x, i, kv)	set_kvp(x, i, kv)
+
+// index of the first key >= k (LOWER) or > k (UPPER) in node x.
+#define NI_LOWER_BOUND(x, k) \
+	key_lower_bound<K>(key_at(x, 0), key_stride(), (x)->n, k)
+#define NI_UPPER_BOUND(x, k) \
+	key_upper_bound<K>(key_at(x, 0), key_stride(), (x)->n, k)
+
+// t, a constant when T > 0.
+#define FANOUT (T > 0 ? T : t)
+#define MIN_ITEMS (FANOUT - 1)
+#define MAX_ITEMS (2 * FANOUT - 1)
+#define MAX_LEVELS 32 // height limit.
 
 	// items:  [t-1, 2t-1]
 	// height: <= log(t,(n+1)/2)
@@ -80,12 +141,15 @@ struct btree {
 
 	// b-tree-create(T)
 	// require O(1) disk operations and O(1) CPU time.
-	btree(int _t)
-		: t(_t),
-		node_size(sizeof(node) +2 * _t * sizeof(item))
-#ifdef PROFILE
-		,
+	btree(int _t = T, int alloc = ALLOC_ARENA)
+		: t(T > 0 ? T : _t),
 		node_count(0),
+		node_size(node_bytes(t)),
+		vals_ofs(vals_offset(t)),
+		ptrs_ofs(ptrs_offset(t)),
+		arena(alloc == ALLOC_CALLOC ? NULL
+			: new node_arena(node_bytes(t), arena_pages(alloc))),
+#ifdef PROFILE
 		split_cnt(0),
 		erase_cnt(0),
 		search_miss_cnt(0),
@@ -95,8 +159,9 @@ struct btree {
 		concate_inter_cnt(0),
 		rebalance_cnt(0),
 		rebalance_leaf_cnt(0),
-		rebalance_inter_cnt(0)
+		rebalance_inter_cnt(0),
 #endif
+		root_latch(0)
 	{
 		node *x = allocate_node();
 		x->leaf = true;
@@ -105,6 +170,24 @@ struct btree {
 		root = x;
 	}
 
+	~btree()
+	{
+		if (arena)
+			delete arena; // all nodes at once.
+		else
+			free_tree(root);
+	}
+
+	// free node x and its subtree, calloc nodes only.
+	void free_tree(node *x)
+	{
+		if (!x->leaf) {
+			for (int i = 0; i <= x->n; i++)
+				free_tree(disk_read(NI_PTR(x, i)));
+		}
+		free_node(x);
+	}
+
 	// height of tree.
 	// include root node.
 	int height()
@@ -123,11 +206,130 @@ struct btree {
 
 	const size_t node_size;
 
+	// LAYOUT_SOA: array offsets in node, keys start at items.
+	const size_t vals_ofs;
+	const size_t ptrs_ofs;
+
+	// items per node, one more for the last ptr and one spare.
+	static size_t node_capacity(int t)
+	{
+		return 2 * t + 2;
+	}
+
+	static size_t align_up(size_t n, size_t a)
+	{
+		return (n + a - 1) / a * a;
+	}
+
+	static size_t keys_offset()
+	{
+		return sizeof(node) - NODE_ITEMS * sizeof(item);
+	}
+
+	static size_t vals_offset(int t)
+	{
+		return align_up(keys_offset() + node_capacity(t) * sizeof(K),
+				__alignof__(V));
+	}
+
+	static size_t ptrs_offset(int t)
+	{
+		return align_up(vals_offset(t) + node_capacity(t) * sizeof(V),
+				__alignof__(node *));
+	}
+
+	static size_t node_bytes(int t)
+	{
+		if (L == LAYOUT_SOA)
+			return ptrs_offset(t) + node_capacity(t) * sizeof(node *);
+		if (T > 0)
+			return sizeof(node);
+		return sizeof(node) + 2 * t * sizeof(item);
+	}
+
+	// item fields of node x.
+	K *key_at(node *x, int i)
+	{
+		if (L == LAYOUT_SOA)
+			return (K *)((char *)x + keys_offset()) + i;
+		return &x->items[i].k;
+	}
+
+	V *val_at(node *x, int i)
+	{
+		if (L == LAYOUT_SOA)
+			return (V *)((char *)x + (T > 0 ? vals_offset(T) : vals_ofs)) + i;
+		return &x->items[i].v;
+	}
+
+	node **ptr_at(node *x, int i)
+	{
+		if (L == LAYOUT_SOA)
+			return (node **)((char *)x + (T > 0 ? ptrs_offset(T) : ptrs_ofs))
+				+ i;
+		return &x->items[i].c;
+	}
+
+	// distance of 2 keys in bytes.
+	size_t key_stride()
+	{
+		return L == LAYOUT_SOA ? sizeof(K) : sizeof(item);
+	}
+
+	void move_item(node *x, int i, node *y, int j)
+	{
+		if (L == LAYOUT_SOA) {
+			NI_KEY(x, i) = NI_KEY(y, j);
+			NI_VAL(x, i) = NI_VAL(y, j);
+			NI_PTR(x, i) = NI_PTR(y, j);
+		}
+		else
+			x->items[i] = y->items[j];
+	}
+
+	void move_kvp(node *x, int i, node *y, int j)
+	{
+		if (L == LAYOUT_SOA) {
+			NI_KEY(x, i) = NI_KEY(y, j);
+			NI_VAL(x, i) = NI_VAL(y, j);
+		}
+		else
+			x->items[i].kv = y->items[j].kv;
+	}
+
+	void set_kvp(node *x, int i, key_val kv)
+	{
+		NI_KEY(x, i) = kv.k;
+		NI_VAL(x, i) = kv.v;
+	}
+
+	// node allocator, NULL for calloc.
+	node_arena *arena;
+
 	// create file/append/truncate
 	node *allocate_node()
 	{
 		//size_t sz = sizeof(node) +2 * t * sizeof(item);
-		node *np = (node *) calloc(1, node_size);
+		node *np;
+		if (arena) {
+			// a reused node keeps counting its version, so a stale
+			// reader of the freed node never validates: clear all but
+			// the version, then step it with one store, never back.
+			np = (node *) arena->alloc(false);
+			if (np) {
+				char *p = (char *) np;
+				size_t at = offsetof(node, version);
+				size_t end = at + sizeof(np->version);
+				unsigned long v = __atomic_load_n(&np->version,
+						__ATOMIC_RELAXED);
+				memset(p, 0, at);
+				memset(p + end, 0, node_size - end);
+				__atomic_store_n(&np->version,
+						(v & ~OLC_BITS) + OLC_STEP, __ATOMIC_RELEASE);
+			}
+		}
+		else
+			np = (node *) calloc(1, node_size);
 		if (np == NULL) {
 			cerr << "fail to allocate node." << endl;
 			exit(-1);
@@ -135,7 +337,7 @@ struct btree {
 		//cout << "allocate node: #" << node_count
 		//	<< " [" << np << "]" << endl;
 		// one more item for the last node ptr.
-		node_count++;
+		__atomic_add_fetch(&node_count, 1, __ATOMIC_RELAXED);
 		return np;
 	}
 
@@ -143,8 +345,15 @@ struct btree {
 	{
 		//cout << "[" << x << "] ";
 		//cout << "free node: #" << node_count << endl;
-		free(x);
-		node_count--;
+		// unlock and mark obsolete, before the arena may hand it out.
+		__atomic_store_n(&x->version,
+				((x->version & ~OLC_BITS) + OLC_STEP) | OLC_OBSOLETE,
+				__ATOMIC_RELEASE);
+		if (arena)
+			arena->free(x);
+		else
+			free(x);
+		__atomic_sub_fetch(&node_count, 1, __ATOMIC_RELAXED);
 		//TODO delete node on disk.
 	}
 
@@ -183,17 +392,17 @@ struct btree {
 		// k, v and child ptr.
 		// [0,t-2],[t-1],[t,2t-2]
 		// t-1, 1, t-1
-		for (int j = 0; j < t; j++) // one more for the last ptr.
-			NI_ITEM(z, j) = NI_ITEM(y, t + j); // t for z(with ptr)
+		for (int j = 0; j < FANOUT; j++) // one more for the last ptr.
+			NI_MOVE_ITEM(z, j, y, FANOUT + j); // t for z(with ptr)
 		// shrink node y.
 		y->n = MIN_ITEMS;
 		// make room for median item(from last item of y) of y and z.
 		// insert last item of y into x at index i.
 		// [n,i+1], [i,n + 1]
 		for (int j = x->n + 1; j > i; j--) // include last ptr of x.
-			NI_ITEM(x, j) = NI_ITEM(x, j - 1);
+			NI_MOVE_ITEM(x, j, x, j - 1);
 		// move y.key[t-1] up.
-		NI_KVP(x, i) = NI_KVP(y, t - 1);
+		NI_MOVE_KVP(x, i, y, MIN_ITEMS);
 		NI_PTR(x, i) = y;
 		NI_PTR(x, i + 1) = z;
 		x->n++;
@@ -207,7 +416,7 @@ struct btree {
 	{
 		node *r = root;
 		// root node is full.
-		if (r->n == 2 * t - 1) {
+		if (r->n == MAX_ITEMS) {
 			cout << "insert on full root node #" << root << endl;
 			node *s = allocate_node();
 			root = s;
@@ -225,27 +434,24 @@ struct btree {
 	void insert_nonfull(node *x, key_val kv)
 	{
 		//XXX x->nΪ0.
-		int i = x->n - 1;
+		int i = NI_UPPER_BOUND(x, kv.k);
 		if (x->leaf) {
 			//XXX preserve the last ptr of x.
 			node *lp = NI_LAST_PTR(x);
-			//[1,...,n] <= [0,...,n - 1]
-			for (; i >= 0 && kv.k < NI_KEY(x, i); i--)
-				NI_ITEM(x, i + 1) = NI_ITEM(x, i);
+			//[i+1,...,n] <= [i,...,n - 1]
+			for (int j = x->n; j > i; j--)
+				NI_MOVE_ITEM(x, j, x, j - 1);
 			// insert key-val-pair kv into x.
-			NI_KVP(x, i + 1) = kv;
+			NI_SET_KVP(x, i, kv);
 			x->n++;
 			//XXX restore the last ptr of x.
 			NI_LAST_PTR(x) = lp;
 			disk_write(x);
 		}
 		else {
-			for (; i >= 0 && kv.k < NI_KEY(x, i); i--)
-				;
-			i++; //fix;
 			node *y = disk_read(NI_PTR(x, i));
 			// split the full node.
-			if (y->n == 2 * t - 1) {
+			if (y->n == MAX_ITEMS) {
 				split_child(x, i, y);
 				if (kv.k > NI_KEY(x, i))
 					i++;
@@ -255,6 +461,91 @@ struct btree {
 		}
 	}
 
+	// build the tree bottom up from sorted, unique items [first, last).
+	// nodes are filled left to right up to fill_factor of MAX_ITEMS,
+	// the item after a filled node goes up to the next level as the
+	// separator of it and the next node. no split, every node is
+	// written once, but the right spine, which may be underfull.
+	// the tree must be empty.
+	template <class iterator>
+	void bulk_load(iterator first, iterator last, double fill_factor = 1.0)
+	{
+		assert(root->leaf && root->n == 0);
+		int fill = (int)(fill_factor * MAX_ITEMS);
+		if (fill < MIN_ITEMS)
+			fill = MIN_ITEMS;
+		if (fill > MAX_ITEMS)
+			fill = MAX_ITEMS;
+
+		node *open[MAX_LEVELS]; // the last node of each level.
+		int levels = 1;
+		open[0] = root;
+		for (; first != last; ++first)
+			bulk_push(open, levels, 0, *first, NULL, fill);
+		for (int l = 0; l < levels; l++)
+			disk_write(open[l]);
+		root = open[levels - 1];
+
+		while (bulk_fix_right())
+			;
+	}
+
+	// append kv and its right child c to the last node of level l.
+	void bulk_push(node **open, int &levels, int l, const key_val &kv,
+			node *c, int fill)
+	{
+		node *x = open[l];
+		if (x->n < fill) {
+			NI_SET_KVP(x, x->n, kv);
+			NI_PTR(x, x->n + 1) = c;
+			x->n++;
+			return;
+		}
+		// x is full, kv goes up between x and the new node y.
+		disk_write(x);
+		node *y = allocate_node();
+		y->leaf = x->leaf;
+		y->n = 0;
+		NI_FIRST_PTR(y) = c;
+		open[l] = y;
+		if (l + 1 == levels) { // new root.
+			assert(levels < MAX_LEVELS);
+			node *r = allocate_node();
+			r->leaf = false;
+			r->n = 0;
+			NI_FIRST_PTR(r) = x;
+			open[levels++] = r;
+		}
+		bulk_push(open, levels, l + 1, kv, y, fill);
+	}
+
+	// fix the underfull last child on the right spine, top down.
+	// return true if a concate took a key from a node of the spine,
+	// which may underflow it, so run again.
+	bool bulk_fix_right()
+	{
+		bool again = false;
+		node *x = root;
+		while (!x->leaf) {
+			node *y = disk_read(NI_LAST_PTR(x));
+			if (y->n < MIN_ITEMS) {
+				int n = x->n;
+				fixup(x, x->n);
+				if (x->n < n)
+					again = true;
+				// strip empty root node.
+				if (x == root && x->n == 0) {
+					root = disk_read(NI_FIRST_PTR(x));
+					free_node(x);
+					x = root;
+					continue;
+				}
+			}
+			x = disk_read(NI_LAST_PTR(x));
+		}
+		return again;
+	}
+
 	// find the max item in node x or its subtree.
 	node *search_max(node *x)
 	{
@@ -277,9 +568,182 @@ struct btree {
 		return search_min(s);
 	}
 
-	void dump_item(item it, int i)
+	/*
+	 * In-order iterator, forward and backward.
+	 *
+	 * The path from the root is kept on a stack: the top is the node
+	 * and index of the current item, the levels below it hold the
+	 * child index taken in each node. Coming back up to node p from
+	 * child c, the next item is item c, the previous one item c-1.
+	 * Going down, the next child of the parent is prefetched, it is
+	 * the next subtree the scan enters.
+	 * Any change to the tree invalidates iterators.
+	 */
+	struct iterator {
+		btree *tree;
+		node *path[MAX_LEVELS];
+		int idx[MAX_LEVELS];
+		int depth; // 0: end.
+
+		iterator(btree *t_) :tree(t_), depth(0) {}
+
+		K key()
+		{
+			return *tree->key_at(path[depth - 1], idx[depth - 1]);
+		}
+
+		V &val()
+		{
+			return *tree->val_at(path[depth - 1], idx[depth - 1]);
+		}
+
+		bool operator==(const iterator &it) const
+		{
+			if (depth != it.depth)
+				return false;
+			return depth == 0 || (path[depth - 1] == it.path[depth - 1] &&
+					idx[depth - 1] == it.idx[depth - 1]);
+		}
+
+		bool operator!=(const iterator &it) const
+		{
+			return !(*this == it);
+		}
+
+		// push child c of the top node.
+		node *push_child(int c)
+		{
+			node *p = path[depth - 1];
+			idx[depth - 1] = c;
+			if (c < p->n)
+				__builtin_prefetch(*tree->ptr_at(p, c + 1));
+			node *x = tree->disk_read(*tree->ptr_at(p, c));
+			path[depth++] = x;
+			return x;
+		}
+
+		// down to the min item of the subtree of top child c.
+		void down_min(int c)
+		{
+			node *x = push_child(c);
+			while (!x->leaf)
+				x = push_child(0);
+			idx[depth - 1] = 0;
+		}
+
+		// down to the max item of the subtree of top child c.
+		void down_max(int c)
+		{
+			node *x = push_child(c);
+			while (!x->leaf)
+				x = push_child(x->n);
+			idx[depth - 1] = x->n - 1;
+		}
+
+		// top is past its last item: up to the next one, or end.
+		// in a parent, it is the item after the child taken.
+		void up_next()
+		{
+			while (depth > 0 && idx[depth - 1] >= path[depth - 1]->n)
+				depth--;
+		}
+
+		iterator &operator++()
+		{
+			node *x = path[depth - 1];
+			int i = idx[depth - 1] + 1;
+			if (!x->leaf)
+				down_min(i);
+			else {
+				idx[depth - 1] = i;
+				up_next();
+			}
+			return *this;
+		}
+
+		// end goes to the last item.
+		iterator &operator--()
+		{
+			if (depth == 0) {
+				path[depth++] = tree->root;
+				if (tree->root->n == 0) {
+					depth = 0;
+					return *this;
+				}
+				if (tree->root->leaf)
+					idx[0] = tree->root->n - 1;
+				else
+					down_max(tree->root->n);
+				return *this;
+			}
+			node *x = path[depth - 1];
+			int i = idx[depth - 1];
+			if (!x->leaf) {
+				down_max(i);
+				return *this;
+			}
+			// up to the item before the child taken, or past begin.
+			while (i == 0) {
+				if (--depth == 0)
+					return *this;
+				i = idx[depth - 1];
+			}
+			idx[depth - 1] = i - 1;
+			return *this;
+		}
+	};
+
+	iterator begin()
+	{
+		iterator it(this);
+		it.path[it.depth++] = root;
+		if (!root->leaf)
+			it.down_min(0);
+		else
+			it.idx[0] = 0;
+		it.up_next(); // empty tree.
+		return it;
+	}
+
+	iterator end()
+	{
+		return iterator(this);
+	}
+
+	// first item with key >= k (upper: > k).
+	iterator bound(K k, bool upper)
+	{
+		iterator it(this);
+		node *x = root;
+		it.path[it.depth++] = x;
+		for (;;) {
+			int i = upper ? NI_UPPER_BOUND(x, k) : NI_LOWER_BOUND(x, k);
+			if (!upper && i < x->n && k == NI_KEY(x, i)) {
+				it.idx[it.depth - 1] = i;
+				return it;
+			}
+			if (x->leaf) {
+				it.idx[it.depth - 1] = i;
+				it.up_next();
+				return it;
+			}
+			x = it.push_child(i);
+		}
+	}
+
+	iterator lower_bound(K k)
+	{
+		return bound(k, false);
+	}
+
+	iterator upper_bound(K k)
+	{
+		return bound(k, true);
+	}
+
+	void dump_item(node *x, int i)
 	{
-		cout << "[" << i << "](" << it.c << ", " << it.k << ")" << endl;
+		cout << "[" << i << "](" << NI_PTR(x, i) << ", " << NI_KEY(x, i) << ")" << endl;
 	}
 
 	void dump_node(node *x, int more = 1)
@@ -292,11 +756,9 @@ struct btree {
 		cout << endl << (x == root ? "ROOT " : "INTERN ") << "NODE #" << x << ", N=" << x->n << endl;
 		if (x->n == 0)
 			return;
-		item li, ri;
-		li = NI_FIRST_ITEM(x);
-		ri = NI_LAST_ITEM(x);
-		dump_item(li, 0);
-		dump_item(ri, x->n - 1);
+		dump_item(x, 0);
+		dump_item(x, x->n - 1);
+
 		cout << "[" << x->n << "](" << NI_LAST_PTR(x) << ", *)" << endl;
 		if (!x->leaf) {
 			node *l = disk_read(NI_FIRST_PTR(x));
@@ -323,10 +785,8 @@ struct btree {
 	// search item with key k in node x and its subtree.
 	V *search(node *x, K k)
 	{
-		int i = 0; //XXX
 		// search
-		while (i < x->n && k > NI_KEY(x, i))
-			i++;
+		int i = NI_LOWER_BOUND(x, k);
 		// hit!
 		if (i < x->n && k == NI_KEY(x, i)) {
 			//cout << "hit on x=" << inf->ptr << ", i=" << inf->idx << endl;
@@ -341,6 +801,50 @@ struct btree {
 		return search(y, k);
 	}
 
+#define MULTI_GROUP 16 // lookups in flight.
+
+	// search n keys, out[j]: value of keys[j], NULL if not found.
+	// a group of lookups goes down a level at a time: the node headers,
+	// then the keys of the whole group are prefetched before any node of
+	// the level is searched, so the cache misses of the group overlap.
+	void multi_search(const K *keys, size_t n, V **out)
+	{
+		node *x[MULTI_GROUP];
+		for (size_t b = 0; b < n; b += MULTI_GROUP) {
+			const K *k = keys + b;
+			V **o = out + b;
+			int m = n - b < MULTI_GROUP ? n - b : MULTI_GROUP;
+			int live = m;
+			for (int j = 0; j < m; j++)
+				x[j] = root;
+			while (live) {
+				for (int j = 0; j < m; j++)
+					if (x[j])
+						__builtin_prefetch(x[j]);
+				for (int j = 0; j < m; j++)
+					if (x[j])
+						key_prefetch<K>(key_at(x[j], 0), key_stride(), x[j]->n);
+				for (int j = 0; j < m; j++) {
+					if (!x[j])
+						continue;
+					int i = NI_LOWER_BOUND(x[j], k[j]);
+					if (i < x[j]->n && k[j] == NI_KEY(x[j], i)) {
+						o[j] = &NI_VAL(x[j], i);
+						x[j] = NULL;
+						live--;
+					}
+					else if (x[j]->leaf) {
+						o[j] = NULL;
+						x[j] = NULL;
+						live--;
+					}
+					else
+						x[j] = disk_read(NI_PTR(x[j], i));
+				}
+			}
+		}
+	}
+
 	// erase the max item in node x.
 	// return the (leaf)node that hold the max item.
 	// the max item be deleted after this call.
@@ -352,8 +856,8 @@ struct btree {
 			x->n--;
 			return x;
 		}
+		fixup(x, x->n - 1); // on last item, may concate the last child.
 		node *y = disk_read(NI_LAST_PTR(x));
-		fixup(x, x->n - 1); // on last item.
 		return erase_max(y);
 	}
 
@@ -362,7 +866,7 @@ struct btree {
 		erase(root, k);
 		// strip empty root node.
 		// tree_height--
-		if (root->n == 0) {
+		if (root->n == 0 && !root->leaf) {
 			node *r = NI_FIRST_PTR(root);
 			free_node(root);
 			root = r;
@@ -392,16 +896,14 @@ struct btree {
 		//	cerr << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<" << endl << endl;
 		//}
 
-		int i = 0;
 		// 1 search for key k.
-		while (i < x->n && k > NI_KEY(x, i))
-			i++;
+		int i = NI_LOWER_BOUND(x, k);
 		// hit.
-		if (k == NI_KEY(x, i)) {
+		if (i < x->n && k == NI_KEY(x, i)) {
 			if (x->leaf) {
 				// 1 Erase item on leaf node.
 				for (int j = i; j <= x->n - 1; j++) // last ptr of x included.
-					NI_ITEM(x, j) = NI_ITEM(x, j + 1);
+					NI_MOVE_ITEM(x, j, x, j + 1);
 				x->n--;
 				// FIXUP: node x may underflow.
 				return;
@@ -414,7 +916,7 @@ struct btree {
 				p = erase_max(y); // copy, Find predecessor
 				assert(p != NULL);
 				assert(p->leaf); // erase on leaf.
-				NI_KVP(x, i) = NI_KVP(p, p->n); // paste, the latest deleted kvp in p. 
+				NI_MOVE_KVP(x, i, p, p->n); // paste, the latest deleted kvp in p. 
 			}
 		}
 		else { // if (k <> NI_KEY(x, i)) {
@@ -457,9 +959,9 @@ struct btree {
 		z = disk_read(NI_PTR(x, i + 1));
 		// rebalance: make items equally spread among y and z.
 		//XXX a stricter rule: n <= t.
-		if (y->n < t - 1 || z->n < t - 1) { // < t - 1 ?
+		if (y->n < MIN_ITEMS || z->n < MIN_ITEMS) { // < t - 1 ?
 			int tn = y->n + z->n;
-			if (tn < 2 * t - 1) { // one more for median.
+			if (tn < MAX_ITEMS) { // one more for median.
 				concate(x, i); // y += median + z.
 			}
 			else {
@@ -477,7 +979,8 @@ struct btree {
 	// rebalance of node y, z:
 	// rebalancing of left and right subtree of item i,
 	// equally distribute items among node y and z.
-	void rebalance(node *x, int i)
+	// nz: new size of z, if not equally.
+	void rebalance(node *x, int i, int nz = -1)
 	{
 #ifdef PROFILE
 		rebalance_cnt++;
@@ -485,10 +988,11 @@ struct btree {
 
 		node *y = disk_read(NI_PTR(x, i));
 		node *z = disk_read(NI_PTR(x, i + 1));
-		int tn, an, nz, ny;
+		int tn, an, ny;
 		tn = y->n + z->n; // total
 		an = tn / 2;      // average
-		nz = an;          // new size of z
+		if (nz < 0)
+			nz = an;      // new size of z
 		ny = tn - nz;     // new size of y
 
 #ifdef PROFILE
@@ -504,15 +1008,15 @@ struct btree {
 		if (y->n < ny) { // y << z;
 			int n = ny - y->n;
 			// move top (n-1) items from z to y.
-			NI_KVP(y, y->n) = NI_KVP(x, i); // 1: [n], median in x.
+			NI_MOVE_KVP(y, y->n, x, i); // 1: [n], median in x.
 			// n-1: [0,n-2] [n + 1, n + n2y]
 			for (int j = 0; j <= n - 1; j++) { // one more for last ptr.
-				NI_ITEM(y, (y->n + 1) + j) = NI_ITEM(z, j);
+				NI_MOVE_ITEM(y, (y->n + 1) + j, z, j);
 			}
-			NI_KVP(x, i) = NI_KVP(z, n - 1); // for new median
+			NI_MOVE_KVP(x, i, z, n - 1); // for new median
 			// remove top n items from z.
 			for (int j = n; j <= z->n; j++) { // include last ptr.
-				NI_ITEM(z, j - n) = NI_ITEM(z, j);
+				NI_MOVE_ITEM(z, j - n, z, j);
 			}
 		}
 		else { // if (y->n > ny) { // move nodes from y to z.
@@ -520,16 +1024,16 @@ struct btree {
 			assert(nz == z->n + n);
 			// in z: make room for new items from y.
 			for (int j = nz; j >= n; j--) { // one more for last ptr of z.
-				NI_ITEM(z, j) = NI_ITEM(z, j - n);
+				NI_MOVE_ITEM(z, j, z, j - n);
 			}
 			// n-1: [0,n-2], move last (n-1) items from y to z.
 			for (int j = 0; j <= n - 1; j++) { // one ptr for z from last ptr of y.
-				NI_ITEM(z, j) = NI_ITEM(y, j + ny + 1);
+				NI_MOVE_ITEM(z, j, y, j + ny + 1);
 			}
 			// 1: [n-1], median to z.
-			NI_KVP(z, n - 1) = NI_KVP(x, i);
+			NI_MOVE_KVP(z, n - 1, x, i);
 			// 1: [ny], one from y to median.
-			NI_KVP(x, i) = NI_KVP(y, ny); // preserve last ptr for y.
+			NI_MOVE_KVP(x, i, y, ny); // preserve last ptr for y.
 		}
 		// update node size.
 		y->n = ny;
@@ -570,12 +1074,12 @@ struct btree {
 
 		// cut & paste:
 		// append item i at the end of pn node.
-		NI_KVP(y, y->n) = NI_KVP(x, i); //item [ny].
+		NI_MOVE_KVP(y, y->n, x, i); //item [ny].
 		for (int j = 0; j <= z->n; j++) //item [ny+1, ny+1+nz]
-			NI_ITEM(y, y->n + 1 + j) = NI_ITEM(z, j); // last ptr of z included.
+			NI_MOVE_ITEM(y, y->n + 1 + j, z, j); // last ptr of z included.
 		// remove item i from x.
 		for (int j = i; j < x->n; j++)
-			NI_ITEM(x, j) = NI_ITEM(x, j + 1); // last ptr of x included.
+			NI_MOVE_ITEM(x, j, x, j + 1); // last ptr of x included.
 		NI_PTR(x, i) = y; // fix
 		x->n--;
 		y->n = y->n + 1 + z->n;
@@ -593,58 +1097,482 @@ struct btree {
 		//disk_write(z);
 	}
 
+	/*
+	 * Concurrent mode, optimistic lock coupling.
+	 *
+	 * Readers take no lock: they note the version of a node, read it
+	 * and validate the version is unchanged before they trust what was
+	 * read, else restart from the root. Writers upgrade the versions
+	 * of the nodes they modify to locks, without waiting: a failed
+	 * upgrade releases every lock held and restarts. root_latch guards
+	 * the root pointer as a version of its own.
+	 *
+	 * insert splits full nodes and erase fills minimal nodes on the way
+	 * down, so a change never goes up the tree: only the parent, the
+	 * node and a sibling get locked, then the operation restarts.
+	 * Nodes must come from the arena (type stable memory), and the
+	 * olc_* calls must not be mixed with the single thread ones.
+	 */
+	unsigned long root_latch;
+
+	// enter the concurrent mode, before threads start.
+	void olc_init()
+	{
+		if (arena == NULL) {
+			cerr << "concurrent mode needs the node arena." << endl;
+			exit(-1);
+		}
+		arena->set_shared(true);
+	}
+
+	// wait till unlocked, false if obsolete.
+	static bool olc_read_lock(unsigned long *latch, unsigned long &v)
+	{
+		while ((v = __atomic_load_n(latch, __ATOMIC_ACQUIRE)) & OLC_LOCKED)
+			__builtin_ia32_pause();
+		return !(v & OLC_OBSOLETE);
+	}
+
+	// true if nothing was written since version v.
+	static bool olc_check(unsigned long *latch, unsigned long v)
+	{
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		return __atomic_load_n(latch, __ATOMIC_RELAXED) == v;
+	}
+
+	// lock if still at version v.
+	static bool olc_upgrade(unsigned long *latch, unsigned long v)
+	{
+		return __atomic_compare_exchange_n(latch, &v, v + OLC_LOCKED,
+				false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	}
+
+	static bool olc_try_lock(unsigned long *latch)
+	{
+		unsigned long v = __atomic_load_n(latch, __ATOMIC_RELAXED);
+		return !(v & OLC_BITS) && olc_upgrade(latch, v);
+	}
+
+	static void olc_unlock(unsigned long *latch)
+	{
+		__atomic_fetch_add(latch, OLC_LOCKED, __ATOMIC_RELEASE);
+	}
+
+	// keys in x as read by a reader, -1 if torn.
+	int olc_items(node *x)
+	{
+		int n = __atomic_load_n(&x->n, __ATOMIC_RELAXED);
+		return n < 0 || n > MAX_ITEMS ? -1 : n;
+	}
+
+	// search key k, copy its value to v.
+	bool olc_search(K k, V &v)
+	{
+		unsigned long vr, vx, vc;
+		node *x, *c;
+		int n, i;
+	restart:
+		if (!olc_read_lock(&root_latch, vr))
+			goto restart;
+		x = __atomic_load_n(&root, __ATOMIC_ACQUIRE);
+		if (!olc_read_lock(&x->version, vx) || !olc_check(&root_latch, vr))
+			goto restart;
+		for (;;) {
+			if ((n = olc_items(x)) < 0)
+				goto restart;
+			i = key_lower_bound<K>(key_at(x, 0), key_stride(), n, k);
+			if (i < n && k == NI_KEY(x, i)) {
+				v = NI_VAL(x, i);
+				if (!olc_check(&x->version, vx))
+					goto restart;
+				return true;
+			}
+			if (x->leaf) {
+				if (!olc_check(&x->version, vx))
+					goto restart;
+				return false;
+			}
+			c = NI_PTR(x, i);
+			// c is a child of x till x changes.
+			if (!olc_check(&x->version, vx) ||
+					!olc_read_lock(&c->version, vc) ||
+					!olc_check(&x->version, vx))
+				goto restart;
+			x = c;
+			vx = vc;
+		}
+	}
+
+	void olc_insert(key_val kv)
+	{
+		unsigned long vr, vp, vx, vc, *lp;
+		node *p, *x, *c;
+		int n, i;
+	restart:
+		if (!olc_read_lock(&root_latch, vr))
+			goto restart;
+		x = __atomic_load_n(&root, __ATOMIC_ACQUIRE);
+		if (!olc_read_lock(&x->version, vx) || !olc_check(&root_latch, vr))
+			goto restart;
+		p = NULL; // root_latch.
+		vp = vr;
+		for (;;) {
+			if ((n = olc_items(x)) < 0)
+				goto restart;
+			if (n == MAX_ITEMS) {
+				// split x, its parent (or root_latch) gets the median.
+				lp = p ? &p->version : &root_latch;
+				if (!olc_upgrade(lp, vp))
+					goto restart;
+				if (!olc_upgrade(&x->version, vx)) {
+					olc_unlock(lp);
+					goto restart;
+				}
+				if (p == NULL) {
+					node *s = allocate_node();
+					s->leaf = false;
+					s->n = 0;
+					NI_FIRST_PTR(s) = x;
+					split_child(s, 0, x);
+					__atomic_store_n(&root, s, __ATOMIC_RELEASE);
+				}
+				else
+					split_child(p, NI_UPPER_BOUND(p, kv.k), x);
+				olc_unlock(&x->version);
+				olc_unlock(lp);
+				goto restart;
+			}
+			if (x->leaf)
+				break;
+			i = key_upper_bound<K>(key_at(x, 0), key_stride(), n, kv.k);
+			c = NI_PTR(x, i);
+			if (!olc_check(&x->version, vx) ||
+					!olc_read_lock(&c->version, vc) ||
+					!olc_check(&x->version, vx))
+				goto restart;
+			p = x;
+			vp = vx;
+			x = c;
+			vx = vc;
+		}
+		// a leaf at version vx is not full.
+		if (!olc_upgrade(&x->version, vx))
+			goto restart;
+		insert_nonfull(x, kv);
+		olc_unlock(&x->version);
+	}
+
+	// erase key k, false if not found.
+	bool olc_erase(K k)
+	{
+		unsigned long vr, vx, vc;
+		node *x, *c;
+		int n, i;
+		bool hit;
+	restart:
+		if (!olc_read_lock(&root_latch, vr))
+			goto restart;
+		x = __atomic_load_n(&root, __ATOMIC_ACQUIRE);
+		if (!olc_read_lock(&x->version, vx) || !olc_check(&root_latch, vr))
+			goto restart;
+		for (;;) {
+			if ((n = olc_items(x)) < 0)
+				goto restart;
+			i = key_lower_bound<K>(key_at(x, 0), key_stride(), n, k);
+			hit = i < n && k == NI_KEY(x, i);
+			if (x->leaf) {
+				if (!hit) {
+					if (!olc_check(&x->version, vx))
+						goto restart;
+					return false;
+				}
+				// the root, or more than MIN_ITEMS keys at version vx.
+				if (!olc_upgrade(&x->version, vx))
+					goto restart;
+				for (int j = i; j < x->n; j++) // last ptr of x included.
+					NI_MOVE_ITEM(x, j, x, j + 1);
+				x->n--;
+				olc_unlock(&x->version);
+				return true;
+			}
+			c = NI_PTR(x, i);
+			if (!olc_check(&x->version, vx) ||
+					!olc_read_lock(&c->version, vc) ||
+					!olc_check(&x->version, vx))
+				goto restart;
+			if (olc_items(c) <= MIN_ITEMS) {
+				// c may underflow, take a key from or merge a sibling.
+				olc_fill_child(x, vx, i, c, vc, vr);
+				goto restart;
+			}
+			if (hit) {
+				// k goes away, the max key of subtree c takes its place.
+				if (!olc_upgrade(&x->version, vx))
+					goto restart;
+				if (!olc_upgrade(&c->version, vc)) {
+					olc_unlock(&x->version);
+					goto restart;
+				}
+				if (!olc_erase_max(x, i, c))
+					goto restart;
+				return true;
+			}
+			x = c;
+			vx = vc;
+		}
+	}
+
+	// make minimal child c of x (child i) have more than MIN_ITEMS keys:
+	// rebalance with, or concate a sibling.
+	// x, c at version vx, vc, root_latch at vr.
+	// false if a lock is lost, nothing changed.
+	bool olc_fill_child(node *x, unsigned long vx, int i, node *c,
+			unsigned long vc, unsigned long vr)
+	{
+		// x is the root: may be emptied and stripped.
+		bool at_root = x == __atomic_load_n(&root, __ATOMIC_RELAXED);
+		if (at_root && !olc_upgrade(&root_latch, vr))
+			return false;
+		if (!olc_upgrade(&x->version, vx)) {
+			if (at_root)
+				olc_unlock(&root_latch);
+			return false;
+		}
+		if (!olc_upgrade(&c->version, vc)) {
+			olc_unlock(&x->version);
+			if (at_root)
+				olc_unlock(&root_latch);
+			return false;
+		}
+		int j = i < x->n ? i + 1 : i - 1;
+		node *s = NI_PTR(x, j);
+		if (!olc_try_lock(&s->version)) {
+			olc_unlock(&c->version);
+			olc_unlock(&x->version);
+			if (at_root)
+				olc_unlock(&root_latch);
+			return false;
+		}
+		node *y = i < j ? c : s; // y, z: left, right child.
+		node *z = i < j ? s : c;
+		int l = i < j ? i : j;
+		if (s->n > MIN_ITEMS) {
+			// the new size of c: half of both, rounded up.
+			int tn = y->n + z->n;
+			rebalance(x, l, c == z ? tn - tn / 2 : tn / 2);
+			olc_unlock(&z->version);
+		}
+		else
+			concate(x, l); // z is freed.
+		olc_unlock(&y->version);
+		if (at_root && x->n == 0) {
+			__atomic_store_n(&root, y, __ATOMIC_RELEASE);
+			free_node(x);
+		}
+		else
+			olc_unlock(&x->version);
+		if (at_root)
+			olc_unlock(&root_latch);
+		return true;
+	}
+
+	// move the max key of subtree c, child i of x, to key i of x.
+	// x and c are locked, c has more than MIN_ITEMS keys. minimal nodes
+	// on the way down are filled from their left sibling.
+	// false if a lock is lost, x is unchanged then.
+	bool olc_erase_max(node *x, int i, node *c)
+	{
+		node *y = c;
+		while (!y->leaf) {
+			int j = y->n;
+			node *z = NI_PTR(y, j);
+			if (!olc_try_lock(&z->version))
+				goto abort;
+			if (z->n <= MIN_ITEMS) {
+				node *s = NI_PTR(y, j - 1);
+				if (!olc_try_lock(&s->version)) {
+					olc_unlock(&z->version);
+					goto abort;
+				}
+				if (s->n > MIN_ITEMS) {
+					int tn = s->n + z->n;
+					rebalance(y, j - 1, tn - tn / 2);
+					olc_unlock(&s->version);
+				}
+				else {
+					concate(y, j - 1); // z is freed.
+					z = s;
+				}
+			}
+			olc_unlock(&y->version);
+			y = z;
+		}
+		y->n--;
+		NI_MOVE_KVP(x, i, y, y->n);
+		olc_unlock(&y->version);
+		olc_unlock(&x->version);
+		return true;
+	abort:
+		olc_unlock(&y->version);
+		olc_unlock(&x->version);
+		return false;
+	}
+
 };
 
 Timer timer;
 
-int
-main()
+#ifdef BENCH_ALLOC
+// write every page of block p, as a tree fills its nodes.
+static void touch(void *p, size_t size)
 {
-	long cnt = 65536000; //10000 * 1000;
-	int t = 128; //1024;
+	for (size_t ofs = 0; ofs < size; ofs += 4096)
+		((char *)p)[ofs] = 1;
+	((char *)p)[size - 1] = 1;
+}
 
-	cout << "Input parameters:" << endl;
-	cout << "cnt (default: " << cnt << " ) ";
-	cin >> cnt;
-	cout << "  t (default: " << t << " ) ";
-	cin >> t;
+// node allocation throughput and rss: calloc/free vs. node_arena.
+// allocate cnt nodes, free them in random order, allocate again.
+void bench_alloc(size_t size, long cnt)
+{
+	void **p = new void *[cnt];
+	long *order = new long[cnt];
+	for (long i = 0; i < cnt; i++)
+		order[i] = i;
+	random_shuffle(order, order + cnt);
+
+	for (int a = ALLOC_CALLOC; a <= ALLOC_ARENA_HUGETLB; a++) {
+		node_arena *arena = a == ALLOC_CALLOC ? NULL
+			: new node_arena(size, arena_pages(a));
+		const char *name[] = { "calloc", "arena", "arena(huge)",
+			"arena(hugetlb)" };
+		cout << endl << "### " << name[a] << ": node size: " << size
+			<< ", nodes: " << cnt << endl;
+
+		long rss0 = rss_kb();
+		timer.Start();
+		for (long i = 0; i < cnt; i++) {
+			p[i] = arena ? arena->alloc() : calloc(1, size);
+			touch(p[i], size);
+		}
+		double t_alloc = timer.Stop();
+		long rss1 = rss_kb();
+
+		timer.Start();
+		for (long i = 0; i < cnt; i++) {
+			void *x = p[order[i]];
+			if (arena)
+				arena->free(x);
+			else
+				free(x);
+		}
+		for (long i = 0; i < cnt; i++) {
+			p[i] = arena ? arena->alloc() : calloc(1, size);
+			touch(p[i], size);
+		}
+		double t_churn = timer.Stop();
 
-#if 0
-	benchmark bm(cnt);
-	bm.test();
+		cout << "time for every allocation(sec):  " << t_alloc / cnt << endl
+			<< "time for every free+alloc(sec):  " << t_churn / cnt << endl
+			<< "rss growth(K-bytes):             " << rss1 - rss0 << endl;
+
+		timer.Start();
+		if (arena)
+			delete arena;
+		else
+			for (long i = 0; i < cnt; i++)
+				free(p[i]);
+		double t_release = timer.Stop();
+		cout << "time for release(sec):           " << t_release << endl;
+	}
+	delete [] order;
+	delete [] p;
+}
 #endif
 
-	btree<int, int> tree(t);
+#define MULTI_BATCH 128 // keys of a multi-search request.
+
+// range scans: SCAN_CNT ranges of SCAN_LEN keys.
+#define SCAN_CNT 100000
+#define SCAN_LEN 100
+
+// full scans both ways, then ranges of the keys 1..cnt by iterator
+// vs. a point search per key.
+template <class tree_t>
+void run_scan(tree_t &tree, int *ai, long cnt)
+{
+	cout << "Scanning data..." << endl;
+	long n = 0, bad = 0;
+	int prev = 0;
+	timer.Start();
+	for (typename tree_t::iterator it = tree.begin(); it != tree.end(); ++it) {
+		if (n++ && it.key() <= prev)
+			bad++;
+		prev = it.key();
+	}
+	double scan_time = timer.Stop();
+	cout << "scan count: " << n << ", out of order: " << bad << endl;
+	cout << "time for every forward scan(sec): " << scan_time / cnt << endl;
+
+	n = bad = 0;
+	timer.Start();
+	typename tree_t::iterator it = tree.end();
+	while (n < cnt) {
+		--it;
+		if (n++ && it.key() >= prev)
+			bad++;
+		prev = it.key();
+	}
+	scan_time = timer.Stop();
+	cout << "reverse scan out of order: " << bad << endl;
+	cout << "time for every backward scan(sec): " << scan_time / cnt << endl;
+
+	long ranges = cnt < SCAN_CNT ? cnt : SCAN_CNT;
+	long sum = 0;
+	cout << "Range scanning " << ranges << " x " << SCAN_LEN << " keys..."
+		<< endl;
+	timer.Start();
+	for (long r = 0; r < ranges; r++) {
+		int lo = ai[r];
+		typename tree_t::iterator it = tree.lower_bound(lo);
+		for (int j = 0; j < SCAN_LEN && it != tree.end(); j++, ++it)
+			sum += it.val();
+	}
+	double range_time = timer.Stop();
+	cout << "time for every range scan(sec): " << range_time / ranges << endl;
 
+	timer.Start();
+	for (long r = 0; r < ranges; r++) {
+		int lo = ai[r];
+		for (int k = lo; k < lo + SCAN_LEN && k <= cnt; k++) {
+			int *vp = tree.search(k);
+			if (vp)
+				sum -= *vp;
+		}
+	}
+	range_time = timer.Stop();
+	cout << "time for every range by search(sec): " << range_time / ranges
+		<< endl;
+	cout << "range scan check: " << (sum == 0 ? "ok" : "MISMATCH") << endl;
+}
+
+// insert, search and erase the cnt keys of ai on tree.
+template <class tree_t>
+void run(tree_t &tree, int *ai, long cnt)
+{
 	cout << "item count: " << cnt << endl;
 
 	cout << "sizeof(bool): " << sizeof(bool) << endl;
-	cout << "sizeof(node): " << sizeof(btree<int, int>::node) << endl;
+	cout << "sizeof(node): " << sizeof(typename tree_t::node) << endl;
 	cout << "node size:    " << tree.node_size << endl;
 	
 	cout << "t = " << tree.t << endl;
 	cout << "min items per node: " << (tree.t - 1) << endl;
 	cout << "max items per node: " << (2 * tree.t - 1) << endl;
 
-	cout << "Preparing data..." << endl;
-	timer.Start();
-	int *ai = new int[cnt];
-	long i_prev = 0;
-	for (long i = 0; i < cnt; i++) {
-		ai[i] = i + 1;
-	}
-
-	cout << "Shuffling data..." << endl;
-	random_shuffle(ai, ai + cnt);
-	cout << "Finished shuffling data..." << endl;
-
-	double t_prep = timer.Stop();
-	cout << "Afer " << t_prep << " seconds." << endl;
-	cout << "Finished preparing data..." << endl;
-
 	cout << "Inserting data..." << endl;
 	timer.Start();
-	btree<int, int>::key_val kv;
+	typename tree_t::key_val kv;
 	cout << endl;
 	cerr << fixed << setw(3) << setprecision(2) << setfill(' ');
 	for (int i = 0, i_prev = 0; i < cnt; i++) {
@@ -677,13 +1605,24 @@ main()
 
 	cout << "tree height: " << tree.height() << endl;
 
+	cout << "rss(K-bytes): " << rss_kb() << endl;
+	cout << "huge pages(K-bytes): " << huge_kb() << endl;
+	if (tree.arena)
+		cout << "arena block size: " << tree.arena->block_size << endl
+			<< "arena chunks:     " << tree.arena->chunk_count << endl
+			<< "arena mapped(K-bytes): "
+			<< tree.arena->mapped_bytes() / 1024 << endl;
+
 #if 0
 	cout << "root node:   " << endl;
 	tree.dump_node(tree.root);
 #endif
 
+	// dTLB misses of the searches, if the cpu counts them here.
+	perf_counter tlb;
 	cout << "searching data..." << endl;
 	timer.Start();
+	tlb.start();
 	for (int i = 0, i_prev = 0; i < cnt; i++) {
 		int k = ai [i];
 		int *vp = tree.search(k);
@@ -697,10 +1636,34 @@ main()
 		}
 		#endif
 	}
+	uint64_t search_tlb = tlb.stop();
 	double search_time = timer.Stop();
 	cout << "After " << search_time << " seconds." << endl;
 	cout << "Finished searching data..." << endl;
 	cout << "time for every searching(sec): " << search_time / cnt << endl;
+	if (tlb.ok())
+		cout << "dTLB misses per searching: " << (double)search_tlb / cnt
+			<< endl;
+	else
+		cout << "dTLB misses per searching: n/a" << endl;
+
+	cout << "multi-searching data, batch of " << MULTI_BATCH << "..." << endl;
+	int *out[MULTI_BATCH];
+	long multi_miss = 0;
+	timer.Start();
+	for (long i = 0; i < cnt; i += MULTI_BATCH) {
+		long m = cnt - i < MULTI_BATCH ? cnt - i : MULTI_BATCH;
+		tree.multi_search(ai + i, m, out);
+		for (long j = 0; j < m; j++)
+			if (out[j] == NULL)
+				multi_miss++;
+	}
+	double multi_time = timer.Stop();
+	cout << "After " << multi_time << " seconds." << endl;
+	cout << "multi-search miss count: " << multi_miss << endl;
+	cout << "time for every multi-searching(sec): " << multi_time / cnt << endl;
+
+	run_scan(tree, ai, cnt);
 
 	cout << "Erasing data..." << endl;
 	timer.Start();
@@ -758,8 +1721,262 @@ main()
 		<< "concate_leaf_cnt:      " << tree.concate_leaf_cnt << endl
 		<< "concate_inter_cnt:     " << tree.concate_inter_cnt << endl
 		<< endl;
+}
+
+// sorted input: cnt inserts one by one vs. bulk_load.
+template <class tree_t>
+void run_bulk(int t, int alloc, long cnt, double fill)
+{
+	typedef typename tree_t::key_val key_val;
+	key_val *kvs = new key_val[cnt];
+	for (long i = 0; i < cnt; i++) {
+		kvs[i].k = i + 1;
+		kvs[i].v = (i + 1) * 2;
+	}
 
+	{
+		tree_t tree(t, alloc);
+		cout << "Inserting sorted data..." << endl;
+		timer.Start();
+		for (long i = 0; i < cnt; i++)
+			tree.insert(kvs[i]);
+		double insert_time = timer.Stop();
+		cout << "time for every sorted insertion(sec): "
+			<< insert_time / cnt << endl;
+		cout << "insert node count:  " << tree.node_count << endl;
+	}
+
+	tree_t tree(t, alloc);
+	cout << "Bulk loading sorted data, fill factor: " << fill << endl;
+	timer.Start();
+	tree.bulk_load(kvs, kvs + cnt, fill);
+	double load_time = timer.Stop();
+	cout << "time for every bulk load(sec): " << load_time / cnt << endl;
+	cout << "bulk node count:  " << tree.node_count << endl;
+	cout << "bulk tree height: " << tree.height() << endl;
+
+	long miss = 0;
+	for (long i = 0; i < cnt; i++) {
+		int *vp = tree.search(kvs[i].k);
+		if (vp == NULL || *vp != kvs[i].v)
+			miss++;
+	}
+	cout << "bulk search miss count: " << miss << endl;
+	delete [] kvs;
+}
+
+// writes% of the concurrent workloads.
+#define OLC_READ_HEAVY	5
+#define OLC_MIXED	50
+
+// a thread of the concurrent benchmark: ops operations on the keys
+// of ai, write_pct% of them erase a key and insert it back, the other
+// ones search a key. a thread only writes the keys i % threads == id,
+// so keys are never lost or duplicated.
+template <class tree_t>
+void olc_worker(tree_t *tree, int *ai, long cnt, int id, int threads,
+		int write_pct, long ops, long *miss)
+{
+	unsigned long r = 88172645463325252UL + id; // xorshift.
+	long own = (cnt - id + threads - 1) / threads;
+	int v;
+	for (long i = 0; i < ops; i++) {
+		r ^= r << 13;
+		r ^= r >> 7;
+		r ^= r << 17;
+		if ((long)(r % 100) < write_pct && own > 0) {
+			int k = ai[id + (r >> 8) % own * threads];
+			typename tree_t::key_val kv;
+			kv.k = k;
+			kv.v = k * 2;
+			if (tree->olc_erase(k))
+				tree->olc_insert(kv);
+			else
+				(*miss)++;
+		}
+		else if (!tree->olc_search(ai[(r >> 8) % cnt], v))
+			(*miss)++; // or erased by a writer, for now.
+	}
+}
+
+// throughput of 1, 2, 4 .. threads, on read-heavy and mixed workloads.
+template <class tree_t>
+void run_olc(int t, int alloc, int *ai, long cnt, int threads)
+{
+	tree_t tree(t, alloc);
+	tree.olc_init();
+
+	cout << "Concurrent inserting data, threads: " << threads << endl;
+	double t0 = wall_sec();
+	{
+		vector<thread> th;
+		for (int id = 0; id < threads; id++)
+			th.push_back(thread([&tree, ai, cnt, id, threads]() {
+				typename tree_t::key_val kv;
+				for (long i = id; i < cnt; i += threads) {
+					kv.k = ai[i];
+					kv.v = ai[i] * 2;
+					tree.olc_insert(kv);
+				}
+			}));
+		for (int id = 0; id < threads; id++)
+			th[id].join();
+	}
+	double insert_time = wall_sec() - t0;
+	cout << "time for every insertion(sec): " << insert_time / cnt << endl;
+	cout << "node count:  " << tree.node_count << endl;
+
+	const int write_pcts[] = {OLC_READ_HEAVY, OLC_MIXED};
+	for (int w = 0; w < 2; w++) {
+		for (int n = 1; ; n = min(n * 2, threads)) {
+			long ops = cnt / n; // same work on any thread count.
+			vector<long> miss(n, 0);
+			vector<thread> th;
+			t0 = wall_sec();
+			for (int id = 0; id < n; id++)
+				th.push_back(thread(olc_worker<tree_t>, &tree, ai, cnt,
+							id, n, write_pcts[w], ops, &miss[id]));
+			for (int id = 0; id < n; id++)
+				th[id].join();
+			double sec = wall_sec() - t0;
+			long misses = 0;
+			for (int id = 0; id < n; id++)
+				misses += miss[id];
+			cout << "### olc writes=" << write_pcts[w] << "% threads=" << n
+				<< ": " << ops * n / sec / 1e6 << " Mops/s"
+				<< ", miss: " << misses << endl;
+			if (n == threads)
+				break;
+		}
+	}
+
+	long miss = 0;
+	int v;
+	for (long i = 0; i < cnt; i++)
+		if (!tree.olc_search(ai[i], v) || v != ai[i] * 2)
+			miss++;
+	cout << "concurrent search miss count: " << miss << endl;
+}
+
+// run and run_bulk on tree_t, which owns ai.
+// threads > 0: run_olc instead.
+template <class tree_t>
+void run_tree(int t, int alloc, int *ai, long cnt, double fill, int threads)
+{
+	if (threads > 0) {
+		run_olc<tree_t>(t, alloc, ai, cnt, threads);
+		delete [] ai;
+		return;
+	}
+	{
+		tree_t tree(t, alloc);
+		run(tree, ai, cnt);
+	}
 	delete [] ai;
+	run_bulk<tree_t>(t, alloc, cnt, fill);
+}
+
+// runtime t, or a compile-time fanout for the common ones.
+template <node_layout L>
+void run_layout(int t, bool fixed, int alloc, int *ai, long cnt, double fill,
+		int threads)
+{
+	if (fixed) {
+		cout << "fanout: compile-time t = " << t << endl;
+		switch (t) {
+		case 16:
+			return run_tree<btree<int, int, L, 16> >(t, alloc, ai, cnt, fill,
+				threads);
+		case 32:
+			return run_tree<btree<int, int, L, 32> >(t, alloc, ai, cnt, fill,
+				threads);
+		case 64:
+			return run_tree<btree<int, int, L, 64> >(t, alloc, ai, cnt, fill,
+				threads);
+		case 128:
+			return run_tree<btree<int, int, L, 128> >(t, alloc, ai, cnt, fill,
+				threads);
+		case 256:
+			return run_tree<btree<int, int, L, 256> >(t, alloc, ai, cnt, fill,
+				threads);
+		}
+	}
+	cout << "fanout: runtime t = " << t << endl;
+	run_tree<btree<int, int, L> >(t, alloc, ai, cnt, fill, threads);
+}
+
+int
+main()
+{
+	long cnt = 65536000; //10000 * 1000;
+	int t = 128; //1024;
+	int layout = LAYOUT_AOS;
+	int alloc = ALLOC_ARENA;
+	double fill = 1.0;
+	int fixed = 1;
+	int threads = 0;
+
+	cout << "Input parameters:" << endl;
+	cout << "cnt (default: " << cnt << " ) ";
+	cin >> cnt;
+	cout << "  t (default: " << t << " ) ";
+	cin >> t;
+	cout << "layout (default: " << layout << ", AOS: " << LAYOUT_AOS
+		<< ", SOA: " << LAYOUT_SOA << " ) ";
+	cin >> layout;
+	cout << " alloc (default: " << alloc << ", CALLOC: " << ALLOC_CALLOC
+		<< ", ARENA: " << ALLOC_ARENA
+		<< ", ARENA_HUGE: " << ALLOC_ARENA_HUGE
+		<< ", ARENA_HUGETLB: " << ALLOC_ARENA_HUGETLB << " ) ";
+	if (!(cin >> alloc))
+		alloc = ALLOC_ARENA;
+	cout << "  fill (default: " << fill << ", bulk load fill factor ) ";
+	if (!(cin >> fill))
+		fill = 1.0;
+	cout << " fixed (default: " << fixed
+		<< ", 1: compile-time t if t is 16, 32, .. 256, 0: runtime t ) ";
+	if (!(cin >> fixed))
+		fixed = 1;
+	cout << " threads (default: " << threads
+		<< ", >0: concurrent benchmark on 1, 2, 4 .. threads ) ";
+	if (!(cin >> threads))
+		threads = 0;
+
+#if 0
+	benchmark bm(cnt);
+	bm.test();
+#endif
+
+#ifdef BENCH_ALLOC
+	// about as many nodes as cnt keys need.
+	bench_alloc(btree<int, int>::node_bytes(t), cnt / t);
+	return 0;
+#endif
+
+	cout << "Preparing data..." << endl;
+	timer.Start();
+	int *ai = new int[cnt];
+	long i_prev = 0;
+	for (long i = 0; i < cnt; i++) {
+		ai[i] = i + 1;
+	}
+
+	cout << "Shuffling data..." << endl;
+	random_shuffle(ai, ai + cnt);
+	cout << "Finished shuffling data..." << endl;
+
+	double t_prep = timer.Stop();
+	cout << "Afer " << t_prep << " seconds." << endl;
+	cout << "Finished preparing data..." << endl;
+
+	if (layout == LAYOUT_SOA) {
+		cout << "node layout: SOA" << endl;
+		run_layout<LAYOUT_SOA>(t, fixed, alloc, ai, cnt, fill, threads);
+	}
+	else {
+		cout << "node layout: AOS" << endl;
+		run_layout<LAYOUT_AOS>(t, fixed, alloc, ai, cnt, fill, threads);
+	}
 
 	cout << "Press any key to exit." << endl;
 #if 10
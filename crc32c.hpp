@@ -0,0 +1,74 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+
+/*
+ * CRC-32C (Castagnoli), the checksum of the redo log records, root
+ * slots and node pages.
+ * With SSE4.2 (-march=native), the crc32 instruction, 8 bytes at a
+ * time; else table driven, a byte at a time, the table built at first
+ * use. define CRC32C_NO_HW to force the table.
+ */
+
+#if !defined(CRC32C_NO_HW) && defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define CRC32C_HW
+#endif
+
+#define CRC32C_POLY 0x82F63B78U // reversed.
+
+inline const uint32_t *crc32c_table()
+{
+	static uint32_t table[256];
+	static bool built = false;
+	if (!built) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int j = 0; j < 8; j++)
+				c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+			table[i] = c;
+		}
+		built = true;
+	}
+	return table;
+}
+
+// crc of len bytes at p, crc: of the bytes before them, 0 at first.
+inline uint32_t crc32c_sw(uint32_t crc, const void *p, size_t len)
+{
+	const uint32_t *table = crc32c_table();
+	const uint8_t *b = (const uint8_t *)p;
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *b++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+#ifdef CRC32C_HW
+inline uint32_t crc32c(uint32_t crc, const void *p, size_t len)
+{
+	const uint8_t *b = (const uint8_t *)p;
+	uint64_t c = ~crc;
+	for (; len >= 8; len -= 8, b += 8) {
+		uint64_t w;
+		memcpy(&w, b, 8); // unaligned.
+		c = _mm_crc32_u64(c, w);
+	}
+	uint32_t c32 = (uint32_t)c;
+	while (len--)
+		c32 = _mm_crc32_u8(c32, *b++);
+	return ~c32;
+}
+#define CRC32C_IMPL "sse4.2"
+#else
+inline uint32_t crc32c(uint32_t crc, const void *p, size_t len)
+{
+	return crc32c_sw(crc, p, len);
+}
+#define CRC32C_IMPL "table"
+#endif
+
+#endif
@@ -3,8 +3,13 @@
 #include <sys/mman.h> // mmap
 #include <sys/types.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
 #include <assert.h>
 #include <cstring>
+#include <string>
+#include <algorithm>
 
 // on-disk index header, node
 #include "disk.hpp"
@@ -16,64 +21,267 @@ using std::endl;
 
 const char* disk_map::index_header_file_name = (char *)"hdr.bin";
 const char* disk_map::index_inode_file_name = (char *)"idx.bin";
+const char* disk_map::index_log_file_name = (char *)"wal.bin";
+const char* disk_map::index_swap_file_name = (char *)"swap.bin";
 const u32   disk_map::index_bitmap_offset = SZ_4K;
-const u32   disk_map::index_inode_array_offset = SZ_4K + 128*SZ_1K;
-const u32   disk_map::map_len_hdr = SZ_4K + 128*SZ_1K;
-const u64   disk_map::map_len_ino = SZ_4G;
+const u32   disk_map::index_inode_array_offset = SZ_4K + 128*SZ_1K; // v1
+u64         disk_map::pool_pages = 0;
+bool        disk_map::pool_direct = false;
+bool        disk_map::huge_pages = false;
+bool        disk_map::random_access = false;
+u32         disk_map::wal_window = 0;
+bool        disk_map::sync_each = false;
+bool        disk_map::flush_whole = false;
+u32         disk_map::shadow_batch = 0;
+u32         disk_map::verify_mode = VERIFY_OFF;
+bool        disk_map::read_only = false;
+
+// fsync a file or directory by name.
+static bool sync_path(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+bool
+disk_map::replace(const char *suffix)
+{
+    std::string hdr_new = std::string(index_header_file_name) + suffix;
+    std::string idx_new = std::string(index_inode_file_name) + suffix;
+    // the new index on disk before swap.bin names it.
+    if (!sync_path(hdr_new.c_str()) || !sync_path(idx_new.c_str())) {
+        cerr << "disk_map::replace(): fail to sync " << hdr_new << ", "
+             << idx_new << endl;
+        return false;
+    }
+    // the suffix and a newline: a torn swap.bin has no newline.
+    std::string rec = std::string(suffix) + "\n";
+    int fd = open(index_swap_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, rec.c_str(), rec.size()) != (ssize_t)rec.size()
+            || fsync(fd) || !sync_path(".")) {
+        cerr << "disk_map::replace(): fail to write "
+             << index_swap_file_name << endl;
+        if (fd != -1)
+            close(fd);
+        unlink(index_swap_file_name);
+        return false;
+    }
+    close(fd);
+    return finish_replace();
+}
+
+bool
+disk_map::finish_replace()
+{
+    char buf[64];
+    int fd = open(index_swap_file_name, O_RDONLY);
+    if (fd == -1)
+        return true;
+    ssize_t len = ::read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 1 || buf[len - 1] != '\n') { // torn, the old index stays.
+        unlink(index_swap_file_name);
+        return sync_path(".");
+    }
+    buf[len - 1] = 0;
+    // a file renamed already is missing.
+    const char *files[2] = {index_inode_file_name, index_header_file_name};
+    for (int i = 0; i < 2; i++) {
+        std::string from = std::string(files[i]) + buf;
+        if (access(from.c_str(), F_OK) == 0 &&
+                rename(from.c_str(), files[i]) != 0) {
+            cerr << "disk_map::finish_replace(): fail to rename " << from
+                 << ": " << strerror(errno) << endl;
+            return false;
+        }
+    }
+    // the log of the old index, empty: replayed when it was opened.
+    unlink(index_log_file_name);
+    if (!sync_path(".") || unlink(index_swap_file_name) || !sync_path("."))
+        return false;
+    cout << "index files replaced by *" << buf << endl;
+    return true;
+}
+
+long
+disk_map::recover()
+{
+    // an index replaced by a new one, before its log.
+    if (!finish_replace())
+        return -1;
+    struct stat st;
+    if (stat(index_log_file_name, &st) != 0 || st.st_size == 0)
+        return 0;
+    int fh = open(index_header_file_name, O_RDWR | O_CREAT, 0644);
+    int fi = open(index_inode_file_name, O_RDWR | O_CREAT, 0644);
+    long ops = -1;
+    if (fh != -1 && fi != -1)
+        ops = redo_log::replay(index_log_file_name, fh, fi);
+    if (fh != -1)
+        close(fh);
+    if (fi != -1)
+        close(fi);
+    cout << "redo log: " << std::dec << ops << " operations replayed."
+         << endl;
+    return ops;
+}
 
-disk_map::disk_map()
+bool
+disk_map::read_header(const char *hdr_file, index_header &h)
 {
+    int fd = open(hdr_file, O_RDONLY);
+    if (fd == -1)
+        return false;
+    // h untouched if not an index header (zero filled hdr.bin).
+    index_header r;
+    ssize_t len = pread(fd, &r, sizeof(r), 0);
+    close(fd);
+    if (len != sizeof(r) || r.header != 0xd0d0baba)
+        return false;
+    if (r.page_size == 0) // before page sizes, 4K.
+        r.page_size = SZ_4K;
+    h = r;
+    return true;
+}
+
+disk_map::disk_map(u32 page, u32 version)
+    : map_len_hdr(0), page_size(page), map_len_ino(0), map_len_file(0),
+    bitmap(NULL), ino_base(NULL), last_alloc(0xdeadbeef), pool(NULL),
+    fd_pool(-1), op_write(false),
+    wal(NULL), ckpt_cnt(0), ckpt_pages(0), ckpt_runs(0),
+    shadow(shadow_batch > 0), shadow_ops(0), shadow_cnt(0),
+    verify_cnt(0), verify_err(0)
+{
+    assert(sizeof(inode) == INODE_HEADER_SIZE);
+    if (page < SZ_4K || page > SZ_64K || (page & (page - 1))) {
+        cerr << "disk_map(): invalid page size: " << page << endl;
+        throw -3;
+    }
+    if (version != 1 && version != 2) {
+        cerr << "disk_map(): invalid version: " << version << endl;
+        throw -3;
+    }
+    if (shadow && wal_window) {
+        cerr << "disk_map(): shadow paging and redo log, one or the other."
+             << endl;
+        throw -3;
+    }
+
     cout << "size of u32: " << std::dec << sizeof(u32) << endl;
     cout << "size of u64: " << sizeof(u64) << endl;
-        
-    cout << "idx bitmap     : " << std::hex << index_bitmap_offset << endl
-         << "idx node array : " << index_inode_array_offset << endl
-         << "mmap length hdr: " << map_len_hdr << endl
-         << "mmap length ino: " << map_len_ino << endl;
 
-    fd_hdr = open(index_header_file_name, O_RDWR);
-    if (fd_hdr == -1) {
+    // operations committed to the log before a crash, left in it by a
+    // read only open.
+    struct stat st;
+    if (read_only) {
+        if (stat(index_log_file_name, &st) == 0 && st.st_size > 0)
+            cout << index_log_file_name << ": " << std::dec << st.st_size
+                 << " bytes not replayed." << endl;
+    }
+    else if (recover() < 0) {
+        cerr << "disk_map(): fail to replay " << index_log_file_name << endl;
+        throw -4;
+    }
+
+    // the header on disk, or the one of a new index.
+    index_header h(page, version);
+    bool old = read_header(index_header_file_name, h);
+    if (old && (h.page_size != page || h.version != version)) {
+        cerr << "disk_map(): index of version " << std::dec << h.version
+             << ", page size " << h.page_size << ", not "
+             << version << ", " << page << endl;
+        throw -3;
+    }
+    // nodes of an older index have no checksum, 8-byte headers.
+    if (old && h.node_header != INODE_HEADER_SIZE) {
+        cerr << "disk_map(): index of " << std::dec
+             << (h.node_header ? h.node_header : INODE_HEADER_SIZE_V0)
+             << "-byte node headers, not " << INODE_HEADER_SIZE
+             << ", convert it with btree-compact." << endl;
+        throw -3;
+    }
+    if (read_only && !old) {
+        cerr << "disk_map(): no index to open read only." << endl;
+        throw -1;
+    }
+    map_len_hdr = h.header_length();
+
+    cout << "idx bitmap     : " << std::hex << index_bitmap_offset << endl
+         << "mmap length hdr: " << map_len_hdr << endl;
+
+    // both files are created if missing, hdr.bin zero filled.
+    int flags = read_only ? O_RDONLY : O_RDWR | O_CREAT;
+    fd_hdr = open(index_header_file_name, flags, 0644);
+    if (fd_hdr == -1 || fstat(fd_hdr, &st) != 0 ||
+            ((u64)st.st_size < map_len_hdr && (read_only ||
+             ftruncate(fd_hdr, map_len_hdr) != 0))) {
         cerr << "fail to open: " << index_header_file_name << endl;
         throw -1;
     }
     cout << "fd_hdr: " << fd_hdr << endl;
 
-    fd_idx = open(index_inode_file_name, O_RDWR);
+    fd_idx = open(index_inode_file_name, flags, 0644);
     if (fd_idx == -1) {
         cerr << "fail to open: " << index_inode_file_name << endl;
         throw -2;
     }
     cout << "fd_idx: " << fd_idx << endl;
+    if (random_access) // pages read by the pool and its prefetch().
+        posix_fadvise(fd_idx, 0, 0, POSIX_FADV_RANDOM);
+
+    if (pool_pages) {
+        if (pool_pages < POOL_MIN_FRAMES) {
+            cerr << "disk_map(): buffer pool of " << std::dec << pool_pages
+                 << " pages, " << POOL_MIN_FRAMES << " at least." << endl;
+            pool_pages = POOL_MIN_FRAMES;
+        }
+        // O_DIRECT: the pool is the only cache of the pages, frames
+        // and offsets are page aligned.
+        fd_pool = pool_direct ? open(index_inode_file_name, O_RDWR | O_DIRECT)
+            : fd_idx;
+        if (fd_pool == -1) {
+            cerr << "fail to open: " << index_inode_file_name
+                 << " O_DIRECT: " << strerror(errno) << endl;
+            throw -2;
+        }
+        pool = new buffer_pool(fd_pool, page_size, pool_pages, huge_pages);
+        cout << "buffer pool: " << std::dec << pool_pages << " pages"
+             << (pool_direct ? ", O_DIRECT" : "") << endl;
+    }
+
+    if (wal_window) {
+        wal = new redo_log(index_log_file_name, wal_window);
+        if (pool)
+            pool->wal = wal;
+        cout << "redo log: group commit of " << std::dec << wal_window
+             << " operations" << endl;
+    }
 
     cout << "map_len for headr: " << map_len_hdr << endl;
-    cout << "map_len for inode: " << map_len_ino << endl;
     // MAP_PRIVATE: not across process, will not write to file.
     // MAP_SHARED : will write to file.
+    // with the log or shadow paging, nothing is written but by
+    // checkpoint(); read only, never: the root of a slot is set in the
+    // private copy.
     mem_hdr = mmap(NULL, map_len_hdr, PROT_READ | PROT_WRITE,
-            MAP_SHARED, fd_hdr, 0/*offset*/);
+            wal || shadow || read_only ? MAP_PRIVATE : MAP_SHARED,
+            fd_hdr, 0/*offset*/);
     mem_map = (void *)((char *)mem_hdr + index_bitmap_offset);
 
-    u32 map_len_ino_1 = map_len_ino >> 1;
-    cout << "map_len_ino_1: 0x" << std::hex << map_len_ino_1 << endl;
-    ino_arr[0] = (inode *)mmap(NULL, map_len_ino_1, PROT_READ | PROT_WRITE,
-            MAP_SHARED, fd_idx, 0);
-    ino_arr[1] = (inode *)mmap(NULL, map_len_ino_1, PROT_READ | PROT_WRITE,
-            MAP_SHARED, fd_idx, map_len_ino_1);
-
-    if (mem_hdr == MAP_FAILED ||
-            ino_arr[0] == MAP_FAILED ||
-            ino_arr[1] == MAP_FAILED) {
+    if (mem_hdr == MAP_FAILED) {
         cerr << "mmap failed! " << endl
-             << "hdr : " << mem_hdr << endl
-             << "ino1: " << ino_arr[0] << endl
-             << "ino2: " << ino_arr[1] << endl;
+             << "hdr : " << mem_hdr << endl;
+        throw -1;
     } else {
         // index header init.
-        uint *magic = (uint *)mem_hdr;
-        if (*magic != 0xd0d0baba) { // new header.
+        if (!old) { // new header.
             // new an object on pre-allocated memory.
-            hdr = new (mem_hdr) index_header();
-            assert(hdr->max_node_count > 0);
+            hdr = new (mem_hdr) index_header(page_size, version);
+            assert(hdr->max_nodes() > 0);
 			cerr << "disk_map(): " << hdr->length << endl;
             //XXX allocate 1st page for root node.
             u32 *map = (u32 *) mem_map; 
@@ -82,72 +290,114 @@ disk_map::disk_map()
         } else {
             // already init mem region.
             hdr = (struct index_header *) mem_hdr;
+            // as of the last checkpoint, a crash may leave it behind.
+            if (verify_mode && hdr->check_sum &&
+                    hdr->check_sum != hdr->sum()) {
+                cerr << "disk_map(): header checksum mismatch." << endl;
+                verify_err++;
+            }
+            hdr->page_size = page_size;
             cout << "OLD disk map loaded!" << endl;
+            // the tree of the last shadow commit, whatever was written
+            // after it.
+            int s = hdr->last_slot();
+            if (s >= 0) {
+                hdr->set_root(hdr->slot[s].root);
+                hdr->set_nodes(hdr->slot[s].nodes);
+                cout << "shadow root: " << std::dec << hdr->slot[s].root
+                     << ", commit " << hdr->slot[s].seq << endl;
+                // updates in place from now on, the slots would be stale.
+                if (!shadow && !read_only)
+                    memset(hdr->slot, 0, sizeof(hdr->slot));
+            }
         }
         cout << "mmap       @ " << std::hex << hdr << endl
              << "hdr_len:     " << hdr->length << endl
              << "map_len_hdr: " << map_len_hdr << endl
-             << "map_len_ino: " << map_len_ino << endl
-             << "header:      " << hdr->header << endl;
+             << "header:      " << hdr->header << endl
+             << "version:     " << std::dec << hdr->version << endl;
     }
 
-    cout << "max node count: " << hdr->max_node_count << endl;
+    // address space of the pages of the bitmap reserved, idx.bin is
+    // mapped on it from the start as it grows, so nodes never move.
+    map_len_ino = hdr->node_span() * page_size;
+    cout << "page size: " << std::dec << page_size << endl
+         << "map_len for inode: 0x" << std::hex << map_len_ino << endl;
+    void *mem_ino = mmap(NULL, map_len_ino, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_ino == MAP_FAILED) {
+        cerr << "mmap failed! " << endl
+             << "ino : " << mem_ino << endl;
+        throw -1;
+    }
+    ino_base = (inode *)mem_ino;
+    if (fstat(fd_idx, &st) != 0 || !grow(st.st_size))
+        throw -2;
+    cout << "idx.bin mapped: 0x" << map_len_file << endl;
+
+    cout << "max node count: " << std::dec << hdr->max_nodes() << endl;
+
+    // bitmap words of the mapped pages, summary rebuilt here.
+    bitmap = new inode_bitmap((u32 *)mem_map, map_len_file / page_size / 32);
+
+    // a new header is in private memory, on disk before any log.
+    if ((wal || shadow) && !old) {
+        op_words.push_back(0);
+        if (!checkpoint())
+            throw -4;
+    }
 }
 
 //XXX
 disk_map::inode *
-disk_map::allocate_inode()
+disk_map::allocate_inode(u64 hint)
 {
-    static u32 last_idx = 0xdeadbeef;
-    // scan bitmap for free slot.
-    u32 i, j, found = 0, idx, map, *bitmap;
-    // max inode count: 1M.
-    u32 n_32 = SZ_1K * SZ_1K / 32; //1M-bit/32-bit=32K (128K-byte)
-
-    //assert(n_32 == 32 * SZ_1K);
+    u64 idx;
 
     assert(hdr->header == 0xd0d0baba);
-    if (hdr->node_count >= hdr->max_node_count) {
-        cerr << "hdr:     node_count = " << hdr->node_count << endl
-             << "hdr: max_node_count = " << hdr->max_node_count << endl
+    if (read_only) {
+        cerr << "disk_map::allocate_inode(): index opened read only."
+             << endl;
+        return NULL;
+    }
+    if (hdr->nodes() >= hdr->max_nodes()) {
+        cerr << "hdr:     node_count = " << hdr->nodes() << endl
+             << "hdr: max_node_count = " << hdr->max_nodes() << endl
              << "disk_map::allocate_inode(): run out of inode." << endl;
         return NULL;
     }
 
-    bitmap = (u32 *)mem_map;
-    for (i = 0; i < n_32 && !found; i++) { //1M inodes, 128K bytes.
-        if (bitmap[i] == 0xFFFFFFFFUL)
-            continue;
-        for (j = 0; j < 32; j++) { // 4-bytes
-//cerr << std::hex << "i: 0x" << i << ", j: 0x" << j
-//    << ", map: 0x" << bitmap[i] << endl;
-            if (bitmap[i] & (1 << j))
-                continue;
-            found = 1;
-            bitmap[i] |= (1 << j); // mark.
-            idx = i * 32 + j;
-            break;
-        }
-    }
-    if (!found) {
+    long found = bitmap->alloc(hint);
+    // every page of idx.bin in use, one more chunk.
+    if (found < 0 && grow(map_len_file + page_size))
+        found = bitmap->alloc(hint);
+    if (found < 0) {
         cerr << std::dec;
         cerr << "allocate_inode(): not found." << endl
-            << "n_32: " << n_32
-            << ", i:  " << i << endl
-            << "hdr->node_count:     " << hdr->node_count << endl
-            << "hdr->max_node_count: " << hdr->max_node_count << endl;
+            << "hdr->node_count:     " << hdr->nodes() << endl
+            << "hdr->max_node_count: " << hdr->max_nodes() << endl;
+        return NULL;
+    }
+    idx = found;
+    // offset of node array; a new page is not read in by the pool.
+    inode *ino = pool ? (inode *)pool->pin(idx, true, true) : get_inode(idx);
+    if (ino == NULL) {
+        bitmap->free(idx);
         return NULL;
     }
-    // offset of node array.
-    inode *ino = get_inode(idx);
 //cerr << "HDR: " << hdr << endl
 //     << "BIT: " << mem_map << endl
 //     << "INO: " << ino << endl;
-    hdr->node_count++;
+    hdr->set_nodes(hdr->nodes() + 1);
     //XXX clear inode.
-    memset(ino, 0, SZ_4K);
-    ino->length = SZ_4K; //???
+    memset(ino, 0, page_size);
+    ino->length = page_size; //???
     ino->index = idx;
+    seal(ino);
+    op_pages.push_back(idx);
+    op_words.push_back(idx / 32);
+    if (shadow)
+        fresh.add(idx);
 
     //XXX sync to hdr.bin file
     //msync(mem_hdr, map_len_hdr, MS_ASYNC);
@@ -155,25 +405,25 @@ disk_map::allocate_inode()
 #if 0
 cerr << "allocate_inode(): idx=" << std::setw(10) << idx
      << ", ino=" << std::setw(10) << ino
-     << ", node_count=" << std::setw(10) << hdr->node_count
+     << ", node_count=" << std::setw(10) << hdr->nodes()
      << " "; // << endl;
 #endif
 
     //XXX not linkely.
-    if (last_idx == idx) {
+    if (last_alloc == idx) {
         cerr << "disk_map::allocate_inode(): Duplicate inode index: "
              << idx << endl;
         return NULL;
     }
-    last_idx = idx;
+    last_alloc = idx;
 
     return ino;
 }
 
 void *
-disk_map::allocate()
+disk_map::allocate(u64 hint)
 {
-    inode *ino = allocate_inode();
+    inode *ino = allocate_inode(hint);
     if (ino)
         return ino->payload;
     return NULL;
@@ -182,28 +432,33 @@ disk_map::allocate()
 int
 disk_map::dealloc_inode(inode *ino)
 {
-    if ((size_t)ino % SZ_4K)
+    if (!pool && ((char *)ino - (char *)ino_base) % page_size)
         return -1; // unaligned page addr, invalid.
 
-    if (ino->index > SZ_1K * SZ_1K)
+    u64 idx = inode2index(ino);
+    if (idx >= hdr->node_span())
         return -2;
 
-    inode *ino2 = get_inode(ino->index);
-    if (ino2 != ino)
+    inode *ino2 = get_inode(idx);
+    if (ino2 != ino || ino->index != (u32)idx)
         return -3;
 
-    u32 i, j, idx;
-    idx = ino->index;
-    i = idx / 32;
-    j = idx % 32;
-    u32 *bitmap = (u32 *)mem_map;
-    bitmap[i] &= ~(1 << j);
-    hdr->node_count--;
+    // a node of the committed tree stays till the next commit.
+    if (shadow && !fresh.test(idx)) {
+        shadow_free.push_back(idx);
+        return 0;
+    }
+
+    bitmap->free(idx);
+    hdr->set_nodes(hdr->nodes() - 1);
+    op_words.push_back(idx / 32);
+    if (last_alloc == idx) // free again, not a duplicate if reused.
+        last_alloc = 0;
 
     ino->index = 0;
     ino->length = 0;
-
-    msync(mem_hdr, map_len_hdr, MS_ASYNC);
+    if (pool) // a free page is not written back.
+        pool->clean(ino);
 
     return 0;
 }
@@ -214,20 +469,28 @@ disk_map::payload2inode(void *pay)
      inode *ino = (inode *)((char *)pay - sizeof(inode));
 //cerr << "payload2inode(): payload: " << (void *)pay << endl
 //     << "inode:   " << ino << endl;
-     if (ino->length != SZ_4K) {
+     if (ino->length != page_size) {
          cerr << "payload2inode(): invalid inode." << endl;
          return NULL;
      }
      return ino;
 }
 
-//TODO define as disk_map::node_index_t
-u32
+// by the address: ino->index is only the low 32 bits in v2.
+u64
+disk_map::inode2index(inode *ino)
+{
+    if (pool)
+        return pool->index_of(ino);
+    return ((char *)ino - (char *)ino_base) / page_size;
+}
+
+u64
 disk_map::payload2index(void *pay)
 {
     inode *ino = payload2inode(pay);
     if (ino)
-        return ino->index;
+        return inode2index(ino);
     cerr << "payload2index(): invalid inode." << endl;
     return 0;
 }
@@ -236,7 +499,7 @@ int
 disk_map::dealloc(void *x)
 {
      inode *ino = (inode *)((char *)x - sizeof(struct inode)); 
-     if (ino->length != SZ_4K) {
+     if (ino->length != page_size) {
          cout << "dealloc(): invalid inode." << endl;
          return -1;
      }
@@ -246,55 +509,192 @@ disk_map::dealloc(void *x)
 void *
 disk_map::read_root_node()
 {
-    u32 idx = hdr->root_node_index;
+    u64 idx = hdr->root();
     cout << __func__ << "(): idx:" << idx << endl;
     if (idx == 0)
         return NULL;
-    inode *ino = get_inode(idx);
-    if (ino == NULL)
-        return NULL;
-    return ino->payload;
+    return read(idx);
 }
 
 // relative addr to real address.
-// 1M: 2^20 inodes.
-// [19..0]
+// v1 1M: 2^20 inodes, v2: up to 2^33.
 disk_map::inode *
-disk_map::get_inode(u32 idx)
+disk_map::get_inode(u64 idx)
 {
     if (idx == 0) //XXX reserved.
         return NULL;
-    if (idx & ~0xFFFFF) {
+    if (idx * page_size >= map_len_file) {
         cerr << "disk_map::get_inode(): index out of range." << endl;
         return NULL;
     }
-    // idx: 0 .. 2^20,1M
-    // 19  | 18 .. 0
-    // seg | ofs
-    u32 seg = (idx & (1 << 19)) >> 19; // mod 1/2M; 0/1
-    u32 ofs = idx & 0xFFFFF; // ~(1 << 19)
-    inode *ino = ino_arr[seg];
-    ino = (inode *)((char *)ino + ofs * SZ_4K);
-    return ino;
+    if (pool) {
+        pool->keep = hdr->root();
+        return (inode *)pool->pin(idx, false, op_write);
+    }
+    return (inode *)((char *)ino_base + idx * page_size);
 }
 
 void *
-disk_map::read(u32 idx)
+disk_map::read(u64 idx)
 {
+    u64 miss = pool ? pool->miss_cnt : 0;
     inode *ino = get_inode(idx);
     if (ino == NULL) {
         cerr << "disk_map::read(): invalid index: " << idx; // << endl;
         return NULL;
     }
+    if (verify_mode && !verify(ino, idx, pool && pool->miss_cnt != miss))
+        return NULL;
     return ino->payload;
 }
 
-//XXX do nothing.
+bool
+disk_map::verify(inode *ino, u64 idx, bool missed)
+{
+    // first touch: a page in the pool was checked when read in, or
+    // written by us; mapped, once since open (or drop_cache()).
+    if (verify_mode == VERIFY_FIRST && (pool ? !missed : verified.test(idx)))
+        return true;
+    verify_cnt++;
+    if (ino->crc != inode_sum(ino)) {
+        verify_err++;
+        cerr << "disk_map::read(): checksum mismatch, node " << std::dec
+             << idx << endl;
+        return false;
+    }
+    if (verify_mode == VERIFY_FIRST && !pool)
+        verified.add(idx);
+    return true;
+}
+
+void
+disk_map::prefetch(u64 idx)
+{
+    if (advised.test(idx))
+        return;
+    advised.add(idx);
+    if (pool) { // into the page cache, not the pool.
+        if (idx && idx * page_size < map_len_file)
+            posix_fadvise(fd_idx, idx * page_size, page_size,
+                    POSIX_FADV_WILLNEED);
+        return;
+    }
+    inode *ino = get_inode(idx);
+    if (ino)
+        madvise(ino, page_size, MADV_WILLNEED);
+}
+
+bool
+disk_map::grow(u64 len)
+{
+    // whole chunks, up to 1M pages; read only, the file as it is.
+    u64 chunk = (u64)INDEX_GROW_PAGES * page_size;
+    if (!read_only)
+        len = (len + chunk - 1) / chunk * chunk;
+    if (len > map_len_ino)
+        len = map_len_ino;
+    if (len <= map_len_file)
+        return true;
+
+    // blocks allocated now, not at the first write of a page: a full
+    // disk fails here instead of a SIGBUS later.
+    struct stat st;
+    int err = fstat(fd_idx, &st) ? errno : 0;
+    if (!err && !read_only && (u64)st.st_size < len)
+        err = posix_fallocate(fd_idx, st.st_size, len - st.st_size);
+    if (err) {
+        cerr << "disk_map::grow(): fail to extend "
+             << index_inode_file_name << " to " << std::dec << len
+             << ": " << strerror(err) << endl;
+        return false;
+    }
+    // with the pool, idx.bin is read and written, not mapped.
+    if (!pool && mmap((char *)ino_base + map_len_file, len - map_len_file,
+                read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+                (wal || read_only ? MAP_PRIVATE : MAP_SHARED) | MAP_FIXED,
+                fd_idx, map_len_file) == MAP_FAILED) {
+        cerr << "disk_map::grow(): mmap failed: " << strerror(errno) << endl;
+        return false;
+    }
+    // a new mapping, the advice of the old one is not inherited.
+    if (!pool && random_access)
+        madvise((char *)ino_base + map_len_file, len - map_len_file,
+                MADV_RANDOM);
+    if (!pool && huge_pages)
+        madvise((char *)ino_base + map_len_file, len - map_len_file,
+                MADV_HUGEPAGE);
+    map_len_file = len;
+    if (bitmap)
+        bitmap->extend(map_len_file / page_size / 32);
+    return true;
+}
+
+bool
+disk_map::lock(void *x)
+{
+    static bool warned = false;
+    inode *ino = payload2inode(x);
+    if (ino == NULL)
+        return false;
+    if (pool)
+        pool->lock(ino);
+    else if (mlock(ino, page_size)) {
+        if (!warned)
+            cerr << "disk_map::lock(): mlock failed: " << strerror(errno)
+                 << ", ulimit -l?" << endl;
+        warned = true;
+        return false;
+    }
+    locked.push_back(inode2index(ino));
+    return true;
+}
+
+void
+disk_map::drop_cache()
+{
+    // read from the file again: checked again, prefetched again.
+    verified.clear();
+    advised.clear();
+    // private pages dropped below are on disk first.
+    if (wal)
+        checkpoint();
+    if (pool) {
+        // between operations, every page but the root.
+        pool->unpin_all();
+        pool->invalidate();
+        fdatasync(fd_pool);
+        posix_fadvise(fd_idx, 0, 0, POSIX_FADV_DONTNEED);
+        return;
+    }
+    msync(ino_base, map_len_file, MS_SYNC);
+    // unmap the pages from us, then drop the clean pages; a locked
+    // page fails the whole madvise, so the ranges between them.
+    std::sort(locked.begin(), locked.end());
+    u64 from = 0;
+    for (size_t i = 0; i <= locked.size(); i++) {
+        u64 to = i < locked.size() ? locked[i] : map_len_file / page_size;
+        if (to > from)
+            madvise((char *)ino_base + from * page_size,
+                    (to - from) * page_size, MADV_DONTNEED);
+        from = to + 1;
+    }
+    fdatasync(fd_idx);
+    posix_fadvise(fd_idx, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+// the node is written: its checksum set.
 int
 disk_map::save_inode(inode *addr)
 {
-    if (((size_t)addr) % SZ_4K)
+    if (!pool && ((char *)addr - (char *)ino_base) % page_size)
         return -1; // unaligned addr.
+    seal(addr);
+    // logged or marked dirty at the end of the operation.
+    op_pages.push_back(inode2index(addr));
+    if (pool) { // written back when evicted.
+        pool->mark_dirty(addr);
+        return 0;
+    }
     //XXX save all pages.
     //msync(mem_ino, map_len_ino, MS_ASYNC); // or MS_SYNC.
     //XXX may hang here.
@@ -307,7 +707,7 @@ disk_map::save(void *x)
 //cerr << "+disk_map::save(): payload=" << x << endl;
     inode *ino = (inode *)((char *)x - sizeof(inode)) ;
 //cerr << "ino=" << ino << endl;
-    if (ino->length != SZ_4K) {
+    if (ino->length != page_size) {
         cerr << "disk_map::save(): invalid inode." << endl;
         return -1;
     }
@@ -315,11 +715,209 @@ disk_map::save(void *x)
     return save_inode(ino);
 } 
 
+// sort and drop duplicates.
+static void unique_sort(std::vector<u64> &v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+// write the runs of sz-byte pages at base to fd.
+static bool write_runs(int fd, const char *base,
+        const std::vector<dirty_set::run> &runs, u64 sz)
+{
+    for (size_t i = 0; i < runs.size(); i++) {
+        u64 off = runs[i].first * sz, len = runs[i].second * sz;
+        if (pwrite(fd, base + off, len, off) != (ssize_t)len)
+            return false;
+    }
+    return true;
+}
+
+// write back the runs of sz-byte pages of shared mapped fd: all of
+// them started, then waited for.
+static bool sync_runs(int fd, const std::vector<dirty_set::run> &runs, u64 sz)
+{
+    bool ok = true;
+    for (size_t i = 0; i < runs.size(); i++)
+        ok &= sync_file_range(fd, runs[i].first * sz, runs[i].second * sz,
+                SYNC_FILE_RANGE_WRITE) == 0;
+    for (size_t i = 0; i < runs.size(); i++)
+        ok &= sync_file_range(fd, runs[i].first * sz, runs[i].second * sz,
+                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                SYNC_FILE_RANGE_WAIT_AFTER) == 0;
+    return ok;
+}
+
+void
+disk_map::add_dirty()
+{
+    for (size_t i = 0; i < op_pages.size(); i++)
+        dirty_idx.add(op_pages[i]);
+    dirty_hdr.add(0);
+    for (size_t i = 0; i < op_words.size(); i++)
+        dirty_hdr.add((index_bitmap_offset + op_words[i] * 4) / SZ_4K);
+    op_pages.clear();
+    op_words.clear();
+}
+
+void
+disk_map::end_op()
+{
+    if (!op_write)
+        return;
+    op_write = false;
+    unique_sort(op_pages);
+    unique_sort(op_words);
+
+    if (wal) {
+        // new images of the pages, the header, the bitmap words.
+        for (size_t i = 0; i < op_pages.size(); i++) {
+            u64 idx = op_pages[i];
+            void *p = pool ? (void *)pool->lookup(idx)
+                : (void *)((char *)ino_base + idx * page_size);
+            if (p)
+                wal->append(WAL_IDX, idx, p, page_size);
+        }
+        hdr->check_sum = hdr->sum();
+        wal->append(WAL_HDR, 0, hdr, sizeof(index_header));
+        u32 *map = (u32 *)mem_map;
+        for (size_t i = 0; i < op_words.size(); i++)
+            wal->append(WAL_HDR, index_bitmap_offset + op_words[i] * 4,
+                    &map[op_words[i]], 4);
+        wal->commit();
+    }
+    add_dirty();
+    if (shadow) {
+        if (++shadow_ops >= shadow_batch)
+            shadow_commit();
+    }
+    else if ((wal && wal->size() >= WAL_CHECKPOINT_BYTES) ||
+            (!wal && sync_each))
+        checkpoint();
+}
+
+bool
+disk_map::shadow_commit()
+{
+    // the nodes of the new tree on disk, then its root.
+    if (!checkpoint())
+        return false;
+    int s = hdr->last_slot();
+    index_header::root_slot &r = hdr->slot[s == 0 ? 1 : 0];
+    r.root = hdr->root();
+    r.seq = (s < 0 ? 0 : hdr->slot[s].seq) + 1;
+    r.nodes = hdr->nodes() - shadow_free.size();
+    r.crc = r.sum();
+    hdr->check_sum = hdr->sum();
+    if (pwrite(fd_hdr, mem_hdr, SZ_4K, 0) != SZ_4K || fdatasync(fd_hdr)) {
+        cerr << "disk_map::shadow_commit(): fail to write the root." << endl;
+        return false;
+    }
+    // the nodes replaced are free now, their bitmap words written and
+    // synced behind the root. a crash before the root leaves the batch
+    // allocated, see btree::shadow_reclaim(); after it, nothing.
+    u32 *map = (u32 *)mem_map;
+    for (size_t i = 0; i < shadow_free.size(); i++) {
+        u64 idx = shadow_free[i];
+        inode *ino = get_inode(idx);
+        bitmap->free(idx);
+        op_words.push_back(idx / 32);
+        if (pwrite(fd_hdr, &map[idx / 32], 4,
+                    index_bitmap_offset + idx / 32 * 4) != 4)
+            cerr << "disk_map::shadow_commit(): fail to free "
+                 << idx << endl;
+        if (ino) {
+            ino->index = 0;
+            ino->length = 0;
+            if (pool)
+                pool->clean(ino);
+        }
+    }
+    if (!shadow_free.empty() && fdatasync(fd_hdr))
+        cerr << "disk_map::shadow_commit(): fail to sync the bitmap." << endl;
+    hdr->set_nodes(r.nodes);
+    shadow_free.clear();
+    fresh.clear();
+    shadow_ops = 0;
+    shadow_cnt++;
+    return true;
+}
+
+void
+disk_map::shadow_reclaim(u64 idx)
+{
+    bitmap->free(idx);
+    op_words.push_back(idx / 32);
+}
+
+bool
+disk_map::checkpoint()
+{
+    // the log first: the files get nothing it does not hold.
+    if (wal && !wal->sync())
+        return false;
+    // and the changes of an operation not ended yet (bulk load).
+    add_dirty();
+    hdr->check_sum = hdr->sum();
+    std::vector<dirty_set::run> ri = dirty_idx.runs(), rh = dirty_hdr.runs();
+    bool ok = true;
+    int fd = pool ? fd_pool : fd_idx;
+    if (pool)
+        ok = pool->flush();
+    else if (wal)
+        ok = write_runs(fd_idx, (char *)ino_base, ri, page_size);
+    else if (flush_whole) // as before the dirty pages were known.
+        ok = msync(ino_base, map_len_file, MS_SYNC) == 0;
+    else
+        ok = sync_runs(fd_idx, ri, page_size);
+    // the nodes on disk before the header and bitmap which claim them;
+    // a private header is not in the page cache till then, a crash of
+    // a shadow commit syncing the nodes leaves the old bitmap.
+    ok = ok && fdatasync(fd) == 0;
+    if (wal || shadow)
+        ok = ok && write_runs(fd_hdr, (char *)mem_hdr, rh, SZ_4K);
+    else if (flush_whole)
+        ok = ok && msync(mem_hdr, map_len_hdr, MS_SYNC) == 0;
+    else
+        ok = ok && sync_runs(fd_hdr, rh, SZ_4K);
+    ok = ok && fdatasync(fd_hdr) == 0;
+    if (!ok) {
+        cerr << "disk_map::checkpoint(): fail to write the index." << endl;
+        return false;
+    }
+    // private copies are on disk now, the file pages will do.
+    for (size_t i = 0; wal && !pool && i < ri.size(); i++)
+        madvise((char *)ino_base + ri[i].first * page_size,
+                ri[i].second * page_size, MADV_DONTNEED);
+    for (size_t i = 0; (wal || shadow) && i < rh.size(); i++)
+        madvise((char *)mem_hdr + rh[i].first * SZ_4K,
+                rh[i].second * SZ_4K, MADV_DONTNEED);
+    ckpt_cnt++;
+    ckpt_pages += dirty_idx.size() + dirty_hdr.size();
+    ckpt_runs += ri.size() + rh.size();
+    dirty_idx.clear();
+    dirty_hdr.clear();
+    return wal ? wal->truncate() : true;
+}
+
 disk_map::~disk_map()
 {
+    if (shadow && (shadow_ops || !shadow_free.empty()))
+        shadow_commit();
+    if (!read_only)
+        checkpoint();
+    if (wal) {
+        if (pool)
+            pool->wal = NULL;
+        delete wal;
+    }
+    delete bitmap;
+    delete pool; // dirty pages written back.
+    if (fd_pool != -1 && fd_pool != fd_idx)
+        close(fd_pool);
     // flush mem pages to disk file.
     munmap(mem_hdr, map_len_hdr);
-    munmap(ino_arr[0], map_len_ino >> 1);
-    munmap(ino_arr[1], map_len_ino >> 1);
+    munmap(ino_base, map_len_ino);
 }
 
@@ -1,5 +1,13 @@
 #include <sys/types.h>
 
+#include "bitmap.hpp"
+#include "pool.hpp"
+#include "wal.hpp"
+#include "crc32c.hpp"
+#include <vector>
+#include <cstring>
+#include <cstddef>
+
 #define container_of(ptr, type, member) ({                          \
             const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
             (type *)( (char *)__mptr - offsetof(type,member) );})
@@ -7,17 +15,50 @@
 #define SZ_1K 0x400UL
 #define SZ_4K 0x1000UL
 #define SZ_8K 0x2000UL
+#define SZ_64K 0x10000UL
 #define SZ_4G 0x100000000UL
 
+// idx.bin grows by this many pages, 4M of 4K pages.
+#define INDEX_GROW_PAGES 1024
+
+// format of a new index.
+// 1: up to 1M nodes, u32 child index, 128K bitmap.
+// 2: up to INDEX_V2_SPAN bytes of nodes (8G 4K nodes), 40-bit child
+//    index, bitmap as big as needed (1G for 4K pages, sparse).
+#define INDEX_VERSION 2
+#define INDEX_V2_SPAN (1ULL << 45) // 32T, address space reserved.
+
+// bytes of a node before its payload: length, index, crc.
+#define INODE_HEADER_SIZE 12
+// of an older index, no crc: btree-compact converts it.
+#define INODE_HEADER_SIZE_V0 8
+
+// checksum of a node page checked when the page is read:
+#define VERIFY_OFF    0 // never.
+#define VERIFY_FIRST  1 // at its first read since open or since read in
+                        // from disk (buffer pool).
+#define VERIFY_ALWAYS 2 // at every read.
+
 typedef u_int32_t u32;
 typedef u_int64_t u64;
+typedef u_int8_t  u8;
+
+// 40-bit node index, 5 bytes, the child pointer of a v2 index.
+struct u40 {
+    u32 lo;
+    u8  hi;
+
+    u40() {}
+    u40(u64 v) : lo((u32)v), hi((u8)(v >> 32)) {}
+    operator u64() const { return lo | (u64)hi << 32; }
+} __attribute__((packed));
 
 /*
   (1st 4K-byte region)
   header: 4-byte, 0xd0d0baba
   version: 4-byte, version of index file.
   length: 4-byte, length of index file.
-  check_sum: 4-byte, CRC32 for bitmap.
+  check_sum: 8-byte, crc32c of the header, this field 0.
 
   node count: 4-byte
   max node count: 4-byte (1M, ~10^6 nodes)
@@ -28,12 +69,18 @@ typedef u_int64_t u64;
   max total file size: 8-byte (4T, 2^42 bytes)
 
   root node index num: 4-byte (defaul=0).
+  page size: 4-byte, of a node, 4K .. 64K (0: 4K, older index).
+  v2: high 4-byte of node count, max node count and root node index,
+  0 in v1.
+  node header: 4-byte, bytes before the payload of a node, 12 (0 in an
+  older index, 8, no node checksum).
+  root slots: 2 * 32-byte, the root of the last two shadow commits.
   
-  (2nd 4K-byte region)
-  node bitmap: (offset=4K) 1024-bytes, 1-bit per node, up to 8*10^3 nodes.
+  (2nd region: v1 128K-byte, v2 max node count / 8)
+  node bitmap: (offset=4K) 1-bit per node, up to max node count.
 
-  (3rd region: 4G-byte)
-  node array: (offset=8K) max node array size: 4G bytes.
+  (idx.bin: v1 1M pages, 4G-byte of 4K pages; v2 up to 32T-byte)
+  node array: max node array size: max node count * page size bytes.
   see "layout of node"
   offset is 1M-byte, align to 4K-byte boundry.
 */
@@ -41,8 +88,8 @@ struct index_header {       // aligned to 8-byte
     u32 header;             // 0xd0d0baba
     u32 version;            // 1
 
-    u64 length;             // 4K+128K+4G bytes, length of index file.
-    u64 check_sum;          // of index header.
+    u64 length;             // 4K+128K+1M*page_size bytes, length of index file.
+    u64 check_sum;          // of index header, crc32c, see sum().
 
     u32 node_count;         // new node count.
     u32 max_node_count;     // 1 * 1000 * 1000 nodes.
@@ -54,70 +101,301 @@ struct index_header {       // aligned to 8-byte
     u64 max_total_file_size;// 4*1024*1024*1024*1024, 4T.
 
     u32 root_node_index;    // default = 0.
-    u32 __padding;
+    u32 page_size;          // node/inode size, 0 in an older index: 4K.
+
+    // v2, high 32 bits.
+    u32 node_count_hi;
+    u32 max_node_count_hi;
+    u32 root_node_index_hi;
+    u32 node_header;        // INODE_HEADER_SIZE, 0 in an older index.
+
+    // shadow paging: a commit writes the root of the new tree into the
+    // older slot, the valid slot of the higher seq has the root at open.
+    struct root_slot {
+        u64 root;
+        u64 seq;   // of the commit, 0: none.
+        u64 nodes; // node count.
+        u32 crc;   // of root, seq and nodes.
+        u32 __padding;
 
-    index_header()
+        u32 sum() const { return crc32c(0, this, 3 * sizeof(u64)); }
+        bool valid() const { return seq && crc == sum(); }
+    } slot[2];
+
+    index_header(u32 page = SZ_4K, u32 ver = INDEX_VERSION)
     {
         header = 0xd0d0baba;
-        version = 1;
-        length = SZ_4K + 128*SZ_1K + SZ_4G;
+        version = ver;
         check_sum = 0;
-        node_count = 0;
-        max_node_count = 1000*1000; // 1024 * 1024
+        set_nodes(0);
+        if (version == 1) {
+            set_max_nodes(1000*1000); // 1024 * 1024
+            length = SZ_4K + 128*SZ_1K + (u64)SZ_1K*SZ_1K*page;
+        } else {
+            set_max_nodes(INDEX_V2_SPAN / page);
+            length = SZ_4K + max_nodes() / 8 + INDEX_V2_SPAN;
+        }
         file_count = 0;
         max_file_count = 10000*10000;
         total_file_size = 0;
         max_total_file_size = SZ_4G*SZ_1K; // 4T
-        root_node_index = 0;
+        set_root(0);
+        page_size = page;
+        node_header = INODE_HEADER_SIZE;
+        memset(slot, 0, sizeof(slot));
+    }
+
+    // crc32c of the header with check_sum 0.
+    u32 sum() const
+    {
+        index_header h = *this;
+        h.check_sum = 0;
+        return crc32c(0, &h, sizeof(h));
+    }
+
+    // wide counts and root, of v1 and v2 (v1: high words are 0).
+    u64 nodes()     const { return node_count | (u64)node_count_hi << 32; }
+    u64 max_nodes() const { return max_node_count | (u64)max_node_count_hi << 32; }
+    u64 root()      const { return root_node_index | (u64)root_node_index_hi << 32; }
+    void set_nodes(u64 n)     { node_count = n; node_count_hi = n >> 32; }
+    void set_max_nodes(u64 n) { max_node_count = n; max_node_count_hi = n >> 32; }
+    void set_root(u64 i)      { root_node_index = i; root_node_index_hi = i >> 32; }
+
+    // slot of the last shadow commit, -1 if none.
+    int last_slot() const
+    {
+        if (!slot[0].valid() && !slot[1].valid())
+            return -1;
+        if (!slot[1].valid())
+            return 0;
+        if (!slot[0].valid())
+            return 1;
+        return slot[1].seq > slot[0].seq;
+    }
+
+    // node indexes of the bitmap, the pages of idx.bin: v1 has 2^20,
+    // more than its max node count.
+    u64 node_span() const
+    {
+        if (version == 1)
+            return (u64)SZ_1K * SZ_1K;
+        return max_nodes();
+    }
+
+    // bytes of header and bitmap, hdr.bin.
+    u64 header_length() const
+    {
+        if (version == 1)
+            return SZ_4K + 128*SZ_1K;
+        return SZ_4K + (max_nodes() + 7) / 8;
     }
 };
 
 //TODO u32 overflow???
+// backend of idx.bin: mapped (mmap), or read into a buffer pool of
+// pool_pages pages (pread/pwrite) if pool_pages is set when the
+// disk_map is created, see pool.hpp.
+// with the pool, a node is only valid while pinned: every read()
+// and allocate() pins the page till the next begin_op(), or unpin().
 class disk_map {
 public:
     struct inode {
         u32 length;
-        u32 index; // in the node array.
+        u32 index; // in the node array, low 32 bits in v2.
+        u32 crc;   // crc32c of the page but this field, see seal().
         char payload[0];
     };
 
     // index_header offset: 0
     static const char *index_header_file_name;
     static const char *index_inode_file_name;
+    static const char *index_log_file_name;
+    static const char *index_swap_file_name;
     static const u32 index_bitmap_offset;
     static const u32 index_inode_array_offset;
-    static const u32 map_len_hdr;
-    static const u64 map_len_ino;
+    u64 map_len_hdr;  // header and bitmap.
+    u32 page_size;    // of the index, from its header.
+    u64 map_len_ino;  // node_span() pages, address space reserved.
+    u64 map_len_file; // mapped part of idx.bin, its length.
     
     //int fd; // index file fd for header, bitmap and inodes.
     int fd_hdr, fd_idx;
     struct index_header *hdr;
     void *mem_hdr; // mapping memory addr for head.
     void *mem_map; // mapping memory addr for bitmap.
-    inode *ino_arr[2];
+    inode_bitmap *bitmap; // free inodes, over mem_map.
+    inode *ino_base;  // node array, idx.bin mapped from here.
+    u64 last_alloc;   // node allocated last, never the next one.
+
+    // buffer pool backend, of the disk_maps created from now on.
+    static u64  pool_pages;  // pages of the pool, 0: mmap.
+    static bool pool_direct; // O_DIRECT reads and writes.
+    // 2M pages for the nodes in memory: the pool frames, see
+    // buffer_pool; the mapping of idx.bin madvise(MADV_HUGEPAGE)d, huge
+    // if the file system caches large folios.
+    static bool huge_pages;
+    buffer_pool *pool;       // NULL: mmap.
+    int fd_pool;             // idx.bin for the pool, O_DIRECT or fd_idx.
+    bool op_write;           // pages pinned by this operation get dirty.
+    // no readahead of idx.bin (MADV_RANDOM, POSIX_FADV_RANDOM with the
+    // pool), a fault reads its page only, of the disk_maps created from
+    // now on.
+    static bool random_access;
+    // pages of lock(), kept in memory, drop_cache() too.
+    std::vector<u64> locked;
+    // pages prefetch()ed since open (or drop_cache()): in memory, or on
+    // the way, a syscall for them again is wasted.
+    dirty_set advised;
+
+    // durability, of the disk_maps created from now on.
+    // redo log: the index files are mapped private and written by
+    // checkpoint() only, see wal.hpp.
+    static u32  wal_window;  // operations per log sync, 0: no log.
+    static bool sync_each;   // no log, checkpoint every operation.
+    static bool flush_whole; // no log, a checkpoint msyncs whole files.
+    redo_log *wal;
+    std::vector<u64> op_pages;   // node pages written by the operation.
+    std::vector<u64> op_words;   // bitmap words changed by it.
+    // pages changed since the last checkpoint, of idx.bin and hdr.bin
+    // (4K pages: the header, the bitmap pages of the words).
+    dirty_set dirty_idx, dirty_hdr;
+    // stat.
+    u64 ckpt_cnt, ckpt_pages, ckpt_runs;
+
+    // shadow paging(copy on write), of the disk_maps created from now
+    // on: a node of the last committed tree is not changed but copied,
+    // shadow_commit() publishes the new root in a root slot, every
+    // shadow_batch operations. a crash leaves the last committed tree,
+    // no replay. hdr.bin is mapped private as with the log, the bitmap
+    // of the batch in flight goes to disk with its commit; a crash in
+    // the commit, between the bitmap and the root, leaves the nodes of
+    // the batch allocated, see btree::shadow_reclaim().
+    static u32 shadow_batch; // operations per commit, 0: in place.
+    bool shadow;
+    u32 shadow_ops;          // operations since the last commit.
+    dirty_set fresh;         // nodes allocated since the last commit.
+    std::vector<u64> shadow_free; // nodes of the committed tree freed.
+    u64 shadow_cnt;          // stat: commits.
+    // free node idx, allocated but out of the committed tree, by the
+    // next commit.
+    void shadow_reclaim(u64 idx);
+
+    // node checksums, set by save() and checked by read() as of
+    // verify_mode, of the disk_maps created from now on.
+    static u32 verify_mode;  // VERIFY_OFF(default), _FIRST, _ALWAYS.
+    dirty_set verified;      // nodes checked since open, VERIFY_FIRST.
+    u64 verify_cnt, verify_err; // stat: nodes checked, mismatches.
+
+    // read only, of the disk_maps created from now on: the files
+    // opened O_RDONLY and mapped private, no log replayed, no root slot
+    // cleared, nothing allocated nor written back; an existing index
+    // only (fsck).
+    static bool read_only;
 
-    disk_map();
+    // page, version: page size, 4K .. 64K, and format of a new index;
+    // an existing index must have been created with them.
+    disk_map(u32 page = SZ_4K, u32 version = INDEX_VERSION);
+
+    // header of the index of header file hdr_file, false if not
+    // created yet.
+    static bool read_header(const char *hdr_file, index_header &h);
 
     inode *payload2inode(void *pay);
     // get node index of payload.
-    u32 payload2index(void *pay);
+    u64 payload2index(void *pay);
+    // node index of a page in memory.
+    u64 inode2index(inode *ino);
 
     void *read_root_node();
     
-    // alloc 4K page.
-    inode *allocate_inode();
-    void  *allocate();
+    // alloc a page, near inode hint if not 0.
+    inode *allocate_inode(u64 hint = 0);
+    void  *allocate(u64 hint = 0);
 
     int dealloc_inode(inode *addr);
     int dealloc(void *x);
 
     // relative addr to real address.
-    inode *get_inode(u32 idx);
-    void  *read(u32 idx);
+    inode *get_inode(u64 idx);
+    void  *read(u64 idx);
+    // start reading the page of inode idx in, without waiting for it
+    // (MADV_WILLNEED), once.
+    void   prefetch(u64 idx);
+    // keep the page of x in memory: mlock()ed, or never evicted from
+    // the pool. false if the page could not be locked.
+    bool   lock(void *x);
+    // write the inodes back and drop them from the page cache, so the
+    // next access of each page faults it in from the file: cold cache.
+    // but the locked ones.
+    void   drop_cache();
+    // extend idx.bin to len bytes at least, in INDEX_GROW_PAGES
+    // chunks, and map the new part.
+    bool   grow(u64 len);
+
+    // checksum of the node page at ino.
+    u32 inode_sum(inode *ino)
+    {
+        return crc32c(crc32c(0, ino, offsetof(inode, crc)), ino->payload,
+                page_size - sizeof(inode));
+    }
+    void seal(inode *ino)
+    {
+        ino->crc = inode_sum(ino);
+    }
+    // checksum of node idx at ino, as of verify_mode. missed: the page
+    // was just read in from the file.
+    bool verify(inode *ino, u64 idx, bool missed);
 
     int save_inode(inode *ino);
     int save(void *x);
 
+    // start of a tree operation: the pages pinned by the last one are
+    // released. write: the operation may change any page it reads.
+    void begin_op(bool write)
+    {
+        op_write = write;
+        if (pool)
+            pool->unpin_all();
+    }
+    // end of a write operation: its pages and header logged and
+    // committed, added to the dirty pages, checkpoint'ed (sync_each).
+    void end_op();
+    // write every change to the index files, logged or not, and
+    // empty the log. only the dirty pages are written and synced,
+    // adjacent ones at once.
+    bool checkpoint();
+    // the pages of the operation, dirty.
+    void add_dirty();
+    // x not in the last committed tree, may be changed in place.
+    bool is_fresh(void *x)
+    {
+        return !shadow || fresh.test(payload2index(x));
+    }
+    // write the batch, then its root into the older root slot.
+    bool shadow_commit();
+    // replay the redo log left by a crash into the index files.
+    // return operations replayed, -1 on error.
+    static long recover();
+    // the index files replaced by the ones named with suffix(a new
+    // index, closed): both synced, then renamed over the old ones; a
+    // crash in between is rolled forward by recover(), swap.bin holds
+    // the suffix till then.
+    static bool replace(const char *suffix);
+    // finish a replace() cut short, if any.
+    static bool finish_replace();
+    // page of x not used by this operation any more.
+    void unpin(void *x)
+    {
+        if (pool)
+            pool->unpin(x);
+    }
+    // page of x is an inner node, keep it longer.
+    void retain(void *x)
+    {
+        if (pool)
+            pool->retain(x);
+    }
+
     ~disk_map();
 };
 
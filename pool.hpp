@@ -0,0 +1,286 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+
+#include "wal.hpp"
+
+/*
+ * Buffer pool of index pages, the pread/pwrite backend of disk_map.
+ *
+ * A fixed number of page frames, mapped once and page aligned, so the
+ * index file may be opened O_DIRECT. A page is found thru a hash table
+ * from its node index to its frame. pin() reads the page in if needed
+ * and keeps it in its frame till unpin(), or unpin_all() at the start
+ * of the next tree operation; only frames not pinned are evicted.
+ *
+ * Eviction is CLOCK: the hand takes a reference off every frame it
+ * passes and evicts the first one without any. A page gets 1 on every
+ * pin, an inner node POOL_INNER_REF (retain()), so it outlives that
+ * many sweeps: with a pool a fraction of the index, the upper levels
+ * stay in and a lookup misses at most at the leaf.
+ * Page keep (the root) and the pages of lock() are never evicted.
+ * The frames may be on 2M pages (huge): hugetlbfs ones (MAP_HUGETLB),
+ * else transparent ones.
+ * Dirty frames are written back when evicted, or by flush(), after
+ * the redo log wal, if any, is synced: a page is not written before
+ * the records of its last change.
+ */
+
+#define POOL_INNER_REF 4
+// frames of a pool, at least; left free of the values a multi-get
+// pins, for its descents and the evictions.
+#define POOL_MIN_FRAMES 1024
+#define POOL_HUGE_PAGE (2UL << 20)
+
+class buffer_pool {
+public:
+	struct frame {
+		uint64_t idx;   // node index of the page.
+		int pin;        // pins held.
+		uint8_t ref;    // CLOCK references.
+		bool dirty;
+		bool valid;
+		bool locked;    // never evicted.
+	};
+
+	// stat.
+	uint64_t hit_cnt, miss_cnt, write_cnt, evict_cnt;
+
+	uint64_t keep;      // page never evicted.
+	redo_log *wal;      // synced before a page is written back.
+
+	buffer_pool(int fd_, uint32_t page_size_, uint64_t n_frames_,
+			bool huge = false)
+		: hit_cnt(0), miss_cnt(0), write_cnt(0), evict_cnt(0), keep(0), wal(NULL),
+		fd(fd_), page_size(page_size_), n_frames(n_frames_), hand(0),
+		frames(n_frames_)
+	{
+		map_len = n_frames * page_size;
+		mem = (char *)MAP_FAILED;
+		if (huge) {
+			uint64_t len = (map_len + POOL_HUGE_PAGE - 1) & ~(POOL_HUGE_PAGE - 1);
+			mem = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (mem != MAP_FAILED)
+				map_len = len;
+			else
+				std::cerr << "buffer_pool: no hugetlb pages, transparent"
+					" huge pages instead." << std::endl;
+		}
+		if (mem == MAP_FAILED) {
+			mem = (char *)mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (huge && mem != MAP_FAILED)
+				madvise(mem, map_len, MADV_HUGEPAGE);
+		}
+		if (mem == MAP_FAILED) {
+			std::cerr << "buffer_pool: mmap failed." << std::endl;
+			throw -1;
+		}
+		for (uint64_t f = 0; f < n_frames; f++) {
+			frames[f].pin = 0;
+			frames[f].ref = 0;
+			frames[f].dirty = false;
+			frames[f].valid = false;
+			frames[f].locked = false;
+		}
+		table.reserve(n_frames);
+	}
+
+	~buffer_pool()
+	{
+		flush();
+		munmap(mem, map_len);
+	}
+
+	// page idx in memory, pinned. fresh: a new page, not read in.
+	// NULL if every frame is pinned or the read fails.
+	char *pin(uint64_t idx, bool fresh, bool dirty)
+	{
+		uint64_t f;
+		std::unordered_map<uint64_t, uint64_t>::iterator it = table.find(idx);
+		if (it != table.end()) {
+			f = it->second;
+			hit_cnt++;
+		}
+		else {
+			if (!victim(f))
+				return NULL;
+			char *p = mem + f * page_size;
+			if (fresh)
+				memset(p, 0, page_size);
+			else if (pread(fd, p, page_size, idx * page_size) != (ssize_t)page_size) {
+				std::cerr << "buffer_pool: fail to read page " << idx << std::endl;
+				return NULL;
+			}
+			frames[f].idx = idx;
+			frames[f].valid = true;
+			frames[f].dirty = false;
+			table[idx] = f;
+			miss_cnt++;
+		}
+		frame &fr = frames[f];
+		if (fr.pin++ == 0)
+			pinned.push_back(f);
+		if (fr.ref == 0)
+			fr.ref = 1;
+		fr.dirty |= dirty;
+		return mem + f * page_size;
+	}
+
+	void unpin(void *p)
+	{
+		frame &fr = frames[frame_of(p)];
+		if (fr.pin > 0)
+			fr.pin--;
+	}
+
+	// drop every pin, at the start of an operation.
+	void unpin_all()
+	{
+		for (size_t i = 0; i < pinned.size(); i++)
+			frames[pinned[i]].pin = 0;
+		pinned.clear();
+	}
+
+	// the page of p is an inner node.
+	void retain(void *p)
+	{
+		frames[frame_of(p)].ref = POOL_INNER_REF;
+	}
+
+	// the page of p stays in its frame.
+	void lock(void *p)
+	{
+		frames[frame_of(p)].locked = true;
+	}
+
+	void mark_dirty(void *p)
+	{
+		frames[frame_of(p)].dirty = true;
+	}
+
+	// page of a freed node: no write back.
+	void clean(void *p)
+	{
+		frames[frame_of(p)].dirty = false;
+	}
+
+	// page idx if in a frame, not pinned.
+	char *lookup(uint64_t idx)
+	{
+		std::unordered_map<uint64_t, uint64_t>::iterator it = table.find(idx);
+		return it == table.end() ? NULL : mem + it->second * page_size;
+	}
+
+	// node index of the page at p, in a frame.
+	uint64_t index_of(void *p)
+	{
+		return frames[frame_of(p)].idx;
+	}
+
+	bool contains(void *p)
+	{
+		return (char *)p >= mem && (char *)p < mem + n_frames * page_size;
+	}
+
+	// write back every dirty frame.
+	bool flush()
+	{
+		bool ok = true;
+		for (uint64_t f = 0; f < n_frames; f++)
+			if (frames[f].valid && frames[f].dirty)
+				ok &= write_back(f);
+		return ok;
+	}
+
+	// write back, then empty every frame not pinned.
+	void invalidate()
+	{
+		for (uint64_t f = 0; f < n_frames; f++) {
+			frame &fr = frames[f];
+			if (!fr.valid || fr.pin || fr.locked || fr.idx == keep)
+				continue;
+			if (fr.dirty)
+				write_back(f);
+			table.erase(fr.idx);
+			fr.valid = false;
+			fr.ref = 0;
+		}
+	}
+
+	uint64_t frame_count()
+	{
+		return n_frames;
+	}
+
+private:
+	int fd;
+	uint32_t page_size;
+	uint64_t n_frames;
+	uint64_t hand;      // CLOCK hand.
+	char *mem;
+	uint64_t map_len;   // of the frames, whole huge pages.
+	std::vector<frame> frames;
+	std::vector<uint64_t> pinned;  // frames pinned, maybe unpinned since.
+	std::unordered_map<uint64_t, uint64_t> table; // node index: frame.
+
+	uint64_t frame_of(void *p)
+	{
+		return ((char *)p - mem) / page_size;
+	}
+
+	bool write_back(uint64_t f)
+	{
+		frame &fr = frames[f];
+		if (wal && !wal->sync())
+			return false;
+		if (pwrite(fd, mem + f * page_size, page_size,
+					fr.idx * page_size) != (ssize_t)page_size) {
+			std::cerr << "buffer_pool: fail to write page " << fr.idx
+				<< std::endl;
+			return false;
+		}
+		fr.dirty = false;
+		write_cnt++;
+		return true;
+	}
+
+	// a free frame, a page evicted if needed.
+	bool victim(uint64_t &f)
+	{
+		// every frame may need POOL_INNER_REF passes to get to 0.
+		uint64_t limit = (POOL_INNER_REF + 1) * n_frames + 1;
+		for (uint64_t i = 0; i < limit; i++) {
+			f = hand;
+			hand = hand + 1 < n_frames ? hand + 1 : 0;
+			frame &fr = frames[f];
+			if (!fr.valid)
+				return true;
+			if (fr.pin || fr.locked || fr.idx == keep)
+				continue;
+			if (fr.ref) {
+				fr.ref--;
+				continue;
+			}
+			if (fr.dirty && !write_back(f))
+				return false;
+			table.erase(fr.idx);
+			fr.valid = false;
+			evict_cnt++;
+			return true;
+		}
+		std::cerr << "buffer_pool: every frame pinned, " << n_frames
+			<< " frames." << std::endl;
+		return false;
+	}
+};
+
+#endif
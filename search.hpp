@@ -0,0 +1,251 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+/*
+ * In-node key search.
+ *
+ * Keys of a node are sorted, so the position of key k is the count of
+ * keys less than k (lower bound) or less or equal to k (upper bound).
+ * Big nodes are first narrowed by a binary search, the remaining window
+ * (<= SEARCH_WINDOW keys) is counted with SIMD compares.
+ *
+ * Keys may be interleaved with other fields (item arrays), so every
+ * kernel takes the byte distance of two keys: stride. Packed key
+ * arrays simply pass stride == sizeof(K). Keys of packed items may be
+ * unaligned, they are loaded by memcpy (a plain load on x86).
+ *
+ * Build with -mavx2 (or -march=native) for AVX2, -msse4.2 for SSE4,
+ * define NO_SIMD to force the scalar fallback.
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#if !defined(NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define SEARCH_AVX2
+#elif !defined(NO_SIMD) && defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define SEARCH_SSE4
+#endif
+
+// keys left to the linear (SIMD) scan.
+#define SEARCH_WINDOW 32
+
+#define KEY_PTR(base, stride, i) \
+	((const char *)(base) + (size_t)(i) * (stride))
+#define KEY_AT(K, base, stride, i) key_load<K>(KEY_PTR(base, stride, i))
+
+template <class K>
+inline K key_load(const void *p)
+{
+	K k;
+	memcpy(&k, p, sizeof(K));
+	return k;
+}
+
+// narrow [lo, hi) down to SEARCH_WINDOW keys around the bound,
+// branch free. upper: keys equal to k go left.
+template <class K>
+inline void key_narrow(const void *base, size_t stride, int &lo, int &hi,
+		K k, bool upper)
+{
+	int n = hi - lo;
+	while (n > SEARCH_WINDOW) {
+		int half = n / 2;
+		K m = KEY_AT(K, base, stride, lo + half);
+		lo = (m < k || (upper && m == k)) ? lo + half : lo;
+		n -= half;
+	}
+	hi = lo + n;
+}
+
+// scalar count of keys in [lo, hi) less (or equal) than k.
+template <class K>
+inline int key_count_scalar(const void *base, size_t stride, int lo, int hi,
+		K k, bool upper)
+{
+	int cnt = 0;
+	if (upper) {
+		for (int i = lo; i < hi; i++)
+			cnt += KEY_AT(K, base, stride, i) <= k;
+	}
+	else {
+		for (int i = lo; i < hi; i++)
+			cnt += KEY_AT(K, base, stride, i) < k;
+	}
+	return cnt;
+}
+
+// generic keys: scalar count.
+template <class K>
+struct key_counter {
+	static int count(const void *base, size_t stride, int lo, int hi,
+			K k, bool upper)
+	{
+		return key_count_scalar<K>(base, stride, lo, hi, k, upper);
+	}
+};
+
+#if defined(SEARCH_AVX2)
+
+// 8 x 32-bit lanes; bias flips the sign bit for unsigned keys.
+template <class K, int32_t bias>
+struct key_counter_32 {
+	static int count(const void *base, size_t stride, int lo, int hi,
+			K k, bool upper)
+	{
+		const __m256i b = _mm256_set1_epi32(bias);
+		const __m256i vk = _mm256_xor_si256(_mm256_set1_epi32((int32_t)k), b);
+		const __m256i step = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i vidx = _mm256_mullo_epi32(step, _mm256_set1_epi32((int)stride));
+		int cnt = 0, i = lo;
+		for (; i + 8 <= hi; i += 8) {
+			const char *p = (const char *)base + (size_t)i * stride;
+			__m256i v;
+			if (stride == sizeof(K))
+				v = _mm256_loadu_si256((const __m256i *)p);
+			else
+				v = _mm256_i32gather_epi32((const int *)p, vidx, 1);
+			v = _mm256_xor_si256(v, b);
+			// upper: !(v > k), lower: k > v.
+			__m256i m = upper ? _mm256_cmpgt_epi32(v, vk)
+				: _mm256_cmpgt_epi32(vk, v);
+			int bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+			cnt += upper ? 8 - bits : bits;
+		}
+		return cnt + key_count_scalar<K>(base, stride, i, hi, k, upper);
+	}
+};
+
+// 4 x 64-bit lanes.
+template <class K, int64_t bias>
+struct key_counter_64 {
+	static int count(const void *base, size_t stride, int lo, int hi,
+			K k, bool upper)
+	{
+		const __m256i b = _mm256_set1_epi64x(bias);
+		const __m256i vk = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)k), b);
+		const __m128i vidx = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3),
+				_mm_set1_epi32((int)stride));
+		int cnt = 0, i = lo;
+		for (; i + 4 <= hi; i += 4) {
+			const char *p = (const char *)base + (size_t)i * stride;
+			__m256i v;
+			if (stride == sizeof(K))
+				v = _mm256_loadu_si256((const __m256i *)p);
+			else
+				v = _mm256_i32gather_epi64((const long long *)p, vidx, 1);
+			v = _mm256_xor_si256(v, b);
+			__m256i m = upper ? _mm256_cmpgt_epi64(v, vk)
+				: _mm256_cmpgt_epi64(vk, v);
+			int bits = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+			cnt += upper ? 4 - bits : bits;
+		}
+		return cnt + key_count_scalar<K>(base, stride, i, hi, k, upper);
+	}
+};
+
+#elif defined(SEARCH_SSE4)
+
+// 4 x 32-bit lanes.
+template <class K, int32_t bias>
+struct key_counter_32 {
+	static int count(const void *base, size_t stride, int lo, int hi,
+			K k, bool upper)
+	{
+		const __m128i b = _mm_set1_epi32(bias);
+		const __m128i vk = _mm_xor_si128(_mm_set1_epi32((int32_t)k), b);
+		int cnt = 0, i = lo;
+		for (; i + 4 <= hi; i += 4) {
+			__m128i v;
+			if (stride == sizeof(K))
+				v = _mm_loadu_si128((const __m128i *)
+						((const char *)base + (size_t)i * stride));
+			else
+				v = _mm_setr_epi32(KEY_AT(int32_t, base, stride, i),
+						KEY_AT(int32_t, base, stride, i + 1),
+						KEY_AT(int32_t, base, stride, i + 2),
+						KEY_AT(int32_t, base, stride, i + 3));
+			v = _mm_xor_si128(v, b);
+			__m128i m = upper ? _mm_cmpgt_epi32(v, vk) : _mm_cmpgt_epi32(vk, v);
+			int bits = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(m)));
+			cnt += upper ? 4 - bits : bits;
+		}
+		return cnt + key_count_scalar<K>(base, stride, i, hi, k, upper);
+	}
+};
+
+// 2 x 64-bit lanes.
+template <class K, int64_t bias>
+struct key_counter_64 {
+	static int count(const void *base, size_t stride, int lo, int hi,
+			K k, bool upper)
+	{
+		const __m128i b = _mm_set1_epi64x(bias);
+		const __m128i vk = _mm_xor_si128(_mm_set1_epi64x((int64_t)k), b);
+		int cnt = 0, i = lo;
+		for (; i + 2 <= hi; i += 2) {
+			__m128i v = _mm_set_epi64x(KEY_AT(int64_t, base, stride, i + 1),
+					KEY_AT(int64_t, base, stride, i));
+			v = _mm_xor_si128(v, b);
+			__m128i m = upper ? _mm_cmpgt_epi64(v, vk) : _mm_cmpgt_epi64(vk, v);
+			int bits = __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(m)));
+			cnt += upper ? 2 - bits : bits;
+		}
+		return cnt + key_count_scalar<K>(base, stride, i, hi, k, upper);
+	}
+};
+
+#endif
+
+#if defined(SEARCH_AVX2) || defined(SEARCH_SSE4)
+// integral keys.
+template <> struct key_counter<int32_t> : key_counter_32<int32_t, 0> {};
+template <> struct key_counter<uint32_t>
+	: key_counter_32<uint32_t, INT32_MIN> {};
+template <> struct key_counter<int64_t> : key_counter_64<int64_t, 0> {};
+template <> struct key_counter<uint64_t>
+	: key_counter_64<uint64_t, INT64_MIN> {};
+#endif
+
+// key bytes prefetched whole by key_prefetch(), 16 cache lines.
+#define PREFETCH_SPAN 1024
+
+// prefetch the keys a search of n keys touches first: all of them if
+// they are few, else the probes of the first 3 binary search steps.
+template <class K>
+inline void key_prefetch(const void *base, size_t stride, int n)
+{
+	size_t span = (size_t)n * stride;
+	if (span <= PREFETCH_SPAN) {
+		for (size_t o = 0; o < span; o += 64)
+			__builtin_prefetch((const char *)base + o);
+		return;
+	}
+	// 1/2, 1/4, 3/4, 1/8, 3/8, 5/8, 7/8.
+	for (int d = 2; d <= 8; d *= 2)
+		for (int j = 1; j < d; j += 2)
+			__builtin_prefetch(KEY_PTR(base, stride, (long)n * j / d));
+}
+
+// index of the first key >= k in n keys.
+template <class K>
+inline int key_lower_bound(const void *base, size_t stride, int n, K k)
+{
+	int lo = 0, hi = n;
+	key_narrow<K>(base, stride, lo, hi, k, false);
+	return lo + key_counter<K>::count(base, stride, lo, hi, k, false);
+}
+
+// index of the first key > k in n keys.
+template <class K>
+inline int key_upper_bound(const void *base, size_t stride, int n, K k)
+{
+	int lo = 0, hi = n;
+	key_narrow<K>(base, stride, lo, hi, k, true);
+	return lo + key_counter<K>::count(base, stride, lo, hi, k, true);
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef __WAL_H__
+#define __WAL_H__
+
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "crc32c.hpp"
+
+/*
+ * Redo log of the index, wal.bin.
+ *
+ * A tree operation appends the new image of every node page it wrote
+ * and the bytes of hdr.bin it changed (header, bitmap words), then a
+ * commit record. Records go to a buffer, written and fdatasync'ed once
+ * every window commits: group commit, the last window - 1 operations
+ * may be lost by a crash, never half of one.
+ *
+ * The index files are only written by a checkpoint, after the log is
+ * synced, so a page on disk is never ahead of the log. A checkpoint
+ * empties the log.
+ *
+ * At open, replay() applies the records of every committed operation
+ * to the files and drops the rest: a record is valid if its crc
+ * matches, the log ends at the first one which does not (torn write).
+ */
+
+#define WAL_MAGIC  0xd0d0a1a1
+#define WAL_IDX    1 // page image of idx.bin, at idx * len.
+#define WAL_HDR    2 // bytes of hdr.bin, at offset idx.
+#define WAL_COMMIT 3 // end of an operation, idx: its sequence.
+
+// log bytes a checkpoint is taken at.
+#define WAL_CHECKPOINT_BYTES (64UL << 20)
+
+struct wal_record {
+	uint32_t magic;
+	uint32_t crc;   // of the record, with crc 0, and its data.
+	uint32_t type;
+	uint32_t len;   // bytes of data after the record.
+	uint64_t idx;
+};
+
+class redo_log {
+public:
+	// stat.
+	uint64_t commit_cnt, sync_cnt, byte_cnt;
+
+	redo_log(const char *file, uint32_t window_)
+		: commit_cnt(0), sync_cnt(0), byte_cnt(0), window(window_),
+		unsynced(0), synced_len(0)
+	{
+		fd = open(file, O_RDWR | O_CREAT | O_APPEND, 0644);
+		if (fd == -1) {
+			std::cerr << "redo_log: fail to open: " << file << std::endl;
+			throw -1;
+		}
+		struct stat st;
+		if (fstat(fd, &st) == 0)
+			synced_len = st.st_size;
+	}
+
+	~redo_log()
+	{
+		sync();
+		close(fd);
+	}
+
+	void append(uint32_t type, uint64_t idx, const void *p, uint32_t len)
+	{
+		wal_record r = {WAL_MAGIC, 0, type, len, idx};
+		r.crc = crc32c(crc32c(0, &r, sizeof(r)), p, len);
+		buf.insert(buf.end(), (const char *)&r, (const char *)&r + sizeof(r));
+		buf.insert(buf.end(), (const char *)p, (const char *)p + len);
+	}
+
+	// end of an operation, synced with window - 1 others.
+	bool commit()
+	{
+		append(WAL_COMMIT, ++commit_cnt, NULL, 0);
+		if (++unsynced >= window)
+			return sync();
+		return true;
+	}
+
+	// write the buffer out, durable on return.
+	bool sync()
+	{
+		if (buf.empty())
+			return true;
+		size_t off = 0;
+		while (off < buf.size()) {
+			ssize_t n = write(fd, &buf[off], buf.size() - off);
+			if (n <= 0) {
+				std::cerr << "redo_log: write failed." << std::endl;
+				return false;
+			}
+			off += n;
+		}
+		if (fdatasync(fd)) {
+			std::cerr << "redo_log: fdatasync failed." << std::endl;
+			return false;
+		}
+		synced_len += buf.size();
+		byte_cnt += buf.size();
+		buf.clear();
+		unsynced = 0;
+		sync_cnt++;
+		return true;
+	}
+
+	// bytes of the log, synced or not.
+	uint64_t size()
+	{
+		return synced_len + buf.size();
+	}
+
+	// the index files hold every committed operation: empty the log.
+	bool truncate()
+	{
+		if (!sync() || ftruncate(fd, 0) || fdatasync(fd))
+			return false;
+		synced_len = 0;
+		return true;
+	}
+
+	// apply the committed operations of log file to the index files,
+	// then empty it. return operations replayed, -1 on error.
+	static long replay(const char *file, int fd_hdr, int fd_idx)
+	{
+		int lfd = open(file, O_RDWR);
+		struct stat st;
+		if (lfd == -1 || fstat(lfd, &st) || st.st_size == 0) {
+			if (lfd != -1)
+				close(lfd);
+			return 0;
+		}
+		std::vector<char> log(st.st_size);
+		if (pread(lfd, &log[0], log.size(), 0) != (ssize_t)log.size()) {
+			close(lfd);
+			return -1;
+		}
+		long ops = 0;
+		size_t begin = 0, off = 0; // records of the open operation.
+		while (off + sizeof(wal_record) <= log.size()) {
+			wal_record r;
+			memcpy(&r, &log[off], sizeof(r));
+			if (r.magic != WAL_MAGIC ||
+					off + sizeof(r) + r.len > log.size())
+				break;
+			uint32_t crc = r.crc;
+			r.crc = 0;
+			if (crc32c(crc32c(0, &r, sizeof(r)),
+						&log[off + sizeof(r)], r.len) != crc)
+				break;
+			off += sizeof(r) + r.len;
+			if (r.type != WAL_COMMIT)
+				continue;
+			if (!apply(&log[begin], off - begin, fd_hdr, fd_idx)) {
+				close(lfd);
+				return -1;
+			}
+			begin = off;
+			ops++;
+		}
+		bool ok = fdatasync(fd_hdr) == 0 && fdatasync(fd_idx) == 0 &&
+			ftruncate(lfd, 0) == 0 && fdatasync(lfd) == 0;
+		close(lfd);
+		return ok ? ops : -1;
+	}
+
+private:
+	int fd;
+	uint32_t window;     // commits per sync.
+	uint32_t unsynced;   // commits in the buffer.
+	uint64_t synced_len; // of the log file.
+	std::vector<char> buf;
+
+	// write the records of an operation to the index files.
+	static bool apply(const char *p, size_t len, int fd_hdr, int fd_idx)
+	{
+		for (size_t off = 0; off < len; ) {
+			wal_record r;
+			memcpy(&r, p + off, sizeof(r));
+			const char *data = p + off + sizeof(r);
+			off += sizeof(r) + r.len;
+			ssize_t n = r.len;
+			if (r.type == WAL_IDX)
+				n = pwrite(fd_idx, data, r.len, r.idx * r.len);
+			else if (r.type == WAL_HDR)
+				n = pwrite(fd_hdr, data, r.len, r.idx);
+			if (n != (ssize_t)r.len) {
+				std::cerr << "redo_log: replay write failed." << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+#endif